@@ -63,6 +63,9 @@ module usb #(
 	// SOF indication
 	output wire sof,
 
+	// Bus reset indication (end of it)
+	output wire bus_reset,
+
 	// Common
 	input  wire clk,
 	input  wire rst
@@ -185,6 +188,7 @@ module usb #(
 
 	wire usb_suspend;
 	wire usb_reset;
+	reg  usb_reset_r;
 	reg  rst_pending;
 	reg  rst_clear;
 
@@ -600,6 +604,11 @@ module usb #(
 
 	assign usb_reset = ~timeout_reset[19];
 
+	always @(posedge clk)
+		usb_reset_r <= usb_reset;
+
+	assign bus_reset = usb_reset_r & ~usb_reset;
+
 	always @(posedge clk or posedge rst)
 		if (rst)
 			rst_pending <= 1'b1;
@@ -28,3 +28,18 @@
 #define USB_CORE_BASE	0x82000000
 #define USB_DATA_BASE	0x83000000
 #define SPI_BASE	0x84000000
+
+/* Service USB and flash from IRQs instead of polling, needs CPU_IRQ in
+ * rtl/top.v. Not validated on hardware yet, the polled main loop is the
+ * default */
+#undef USE_IRQ
+
+/* Flash / PSRAM data transfers with SCK at 48 MHz instead of 24, needs
+ * SPI_FAST_SCK in rtl/top.v. Not validated on hardware yet, keep off in
+ * the shipped image */
+#undef SPI_FAST_CLK
+
+/* Cached flash XIP window (rtl/qspi_xip_wb.v) at 0x85000000. Not in
+ * rtl/top.v until something runs from it : fills aren't held off while
+ * the flash is busy and they follow the selected flash chip */
+#undef XIP_BASE
@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include "console.h"
+#include "irq.h"
 #include "misc.h"
 #include "mini-printf.h"
 #include "spi.h"
@@ -94,6 +95,20 @@ static struct usb_fn_drv _ms_os_20_drv = {
 };
 
 
+void
+irq_handler(uint32_t irqs)
+{
+	/* Flash ready, DFU code checks the flag itself */
+	if (irqs & IRQ_SPI)
+		flash_wait_ack();
+
+	/* Everything goes through usb_poll, the timer is used by the
+	 * DFU code to come back when it has more to do */
+	if (irqs & (IRQ_USB | IRQ_SPI | IRQ_TIMER))
+		usb_poll();
+}
+
+
 void main()
 {
 	int cmd = 0;
@@ -154,6 +169,11 @@ void main()
 	usb_register_function_driver(&_ms_os_20_drv);
 	usb_connect();
 
+#ifdef USE_IRQ
+	/* From here on, USB and flash are serviced from IRQs */
+	irq_setmask(~(IRQ_USB | IRQ_SPI | IRQ_TIMER));
+#endif
+
 	/* Main loop */
 	while (1)
 	{
@@ -165,6 +185,10 @@ void main()
 		cmd = getchar_nowait();
 
 		if (cmd >= 0) {
+#ifdef USE_IRQ
+			uint32_t irq_mask = irq_setmask(~0);
+#endif
+
 			if (cmd > 32 && cmd < 127) {
 				putchar(cmd);
 				putchar('\r');
@@ -188,9 +212,20 @@ void main()
 			default:
 				break;
 			}
+
+#ifdef USE_IRQ
+			irq_setmask(irq_mask);
+#endif
 		}
 
+#ifdef USE_IRQ
+		/* SOF wakes us up every ms, without it keep polling the console */
+		enum usb_dev_state state = usb_get_state();
+		if ((state >= USB_DS_DEFAULT) && (state != USB_DS_SUSPENDED))
+			irq_wait();
+#else
 		/* USB poll */
 		usb_poll();
+#endif
 	}
 }
@@ -0,0 +1,62 @@
+/*
+ * irq.h
+ *
+ * Copyright (C) 2019 Sylvain Munaut
+ * All rights reserved.
+ *
+ * LGPL v3+, see LICENSE.lgpl3
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define IRQ_TIMER	(1 << 0)
+#define IRQ_USB_EVT	(1 << 3)
+#define IRQ_USB_SOF	(1 << 4)
+#define IRQ_USB_RST	(1 << 5)
+#define IRQ_SPI		(1 << 6)
+
+#define IRQ_USB		(IRQ_USB_EVT | IRQ_USB_SOF | IRQ_USB_RST)
+
+/* picorv32 custom instructions, a set bit in the mask disables the IRQ */
+
+static inline uint32_t
+irq_setmask(uint32_t mask)
+{
+	uint32_t old;
+	asm volatile (".insn r CUSTOM_0, 6, 3, %0, %1, x0" : "=r" (old) : "r" (mask));
+	return old;
+}
+
+static inline uint32_t
+irq_wait(void)
+{
+	uint32_t pending;
+	asm volatile (".insn r CUSTOM_0, 4, 4, %0, x0, x0" : "=r" (pending));
+	return pending;
+}
+
+static inline uint32_t
+irq_timer(uint32_t cycles)
+{
+	uint32_t old;
+	asm volatile (".insn r CUSTOM_0, 6, 5, %0, %1, x0" : "=r" (old) : "r" (cycles));
+	return old;
+}
+
+void irq_handler(uint32_t irqs);
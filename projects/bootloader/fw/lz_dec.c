@@ -0,0 +1,81 @@
+/*
+ * lz_dec.c
+ *
+ * Copyright (C) 2019 Sylvain Munaut
+ * All rights reserved.
+ *
+ * LGPL v3+, see LICENSE.lgpl3
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lz_dec.h"
+
+
+static inline int
+_lzd_getc(struct lzd_src *src)
+{
+	if ((src->p == src->e) && (!src->refill || !src->refill(src)))
+		return -1;
+	return *src->p++;
+}
+
+bool
+lzd_decode(struct lzd_src *src, uint8_t *out, unsigned len)
+{
+	unsigned o = 0;
+	unsigned n, d;
+	int c, c2;
+
+	while (o < len)
+	{
+		if ((c = _lzd_getc(src)) < 0)
+			return false;
+
+		if (c & 0x80) {
+			/* Match */
+			n = (c & 0x7f) + 3;
+
+			c  = _lzd_getc(src);
+			c2 = _lzd_getc(src);
+			if ((c | c2) < 0)
+				return false;
+
+			d = c | (c2 << 8);
+			if (!d || (d > o) || (n > (len - o)))
+				return false;
+
+			/* Byte-wise, overlapping copies are runs */
+			for (; n; n--, o++)
+				out[o] = out[o - d];
+		} else {
+			/* Literals */
+			n = c + 1;
+			if (n > (len - o))
+				return false;
+
+			for (; n; n--) {
+				if ((c = _lzd_getc(src)) < 0)
+					return false;
+				out[o++] = c;
+			}
+		}
+	}
+
+	return true;
+}
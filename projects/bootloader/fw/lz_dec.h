@@ -0,0 +1,53 @@
+/*
+ * lz_dec.h
+ *
+ * Copyright (C) 2019 Sylvain Munaut
+ * All rights reserved.
+ *
+ * LGPL v3+, see LICENSE.lgpl3
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Compressed DFU stream, as produced by utils/dfu_lz.py :
+ *
+ *  - Header  : "DFUZ" magic, uncompressed length (u32 LE)
+ *  - Blocks  : compressed length (u16 LE), followed by the tokens
+ *              decoding to the next 4k (or less for the last one)
+ *
+ * Matches never cross a block, so each one decodes on its own directly
+ * into a flash sector buffer. Tokens are :
+ *
+ *  - 0lllllll              : l+1 literal bytes follow
+ *  - 1lllllll dddd dddd    : copy l+3 bytes from d (u16 LE) bytes back
+ */
+
+#define LZD_MAGIC	0x5a554644	/* "DFUZ" */
+#define LZD_HDR_LEN	8
+#define LZD_BLK_LEN	4096
+
+struct lzd_src {
+	const uint8_t *p;
+	const uint8_t *e;
+	bool (*refill)(struct lzd_src *src);
+};
+
+bool lzd_decode(struct lzd_src *src, uint8_t *out, unsigned len);
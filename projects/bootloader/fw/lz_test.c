@@ -0,0 +1,282 @@
+/*
+ * lz_test.c
+ *
+ * Copyright (C) 2019 Sylvain Munaut
+ * All rights reserved.
+ *
+ * LGPL v3+, see LICENSE.lgpl3
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Host test of the decompressor : lz_test <compressed> <original>
+ * Decodes the stream block by block like the bootloader does, with the
+ * input fed whole, in small chunks through refill() and split at every
+ * offset of some blocks. Also checks truncated blocks are rejected.
+ *
+ * Without arguments, runs decoder checks on hand made corrupt streams.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz_dec.h"
+
+
+static uint8_t *
+load(const char *name, long *len)
+{
+	FILE *fh;
+	uint8_t *d;
+
+	if (!(fh = fopen(name, "rb"))) {
+		perror(name);
+		exit(1);
+	}
+
+	fseek(fh, 0, SEEK_END);
+	*len = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+
+	d = malloc(*len + 1);
+	if (fread(d, 1, *len, fh) != *len) {
+		fprintf(stderr, "%s: Short read\n", name);
+		exit(1);
+	}
+
+	fclose(fh);
+
+	return d;
+}
+
+static uint32_t
+le(const uint8_t *p, int n)
+{
+	uint32_t v = 0;
+	while (n--)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+
+/* Chunked source, like the bootloader refilling from the PSRAM ring */
+struct feed {
+	struct lzd_src src;
+	const uint8_t *p;	/* Not handed to the decoder yet */
+	const uint8_t *e;
+	unsigned chunk;		/* Bytes per refill */
+	unsigned first;		/* First refill size, 0 to use 'chunk' */
+};
+
+static bool
+feed_refill(struct lzd_src *src)
+{
+	struct feed *f = (struct feed *)src;
+	unsigned n = f->first ? f->first : f->chunk;
+
+	f->first = 0;
+
+	if (n > (f->e - f->p))
+		n = f->e - f->p;
+	if (!n)
+		return false;
+
+	f->src.p = f->p;
+	f->src.e = f->p + n;
+	f->p += n;
+
+	return true;
+}
+
+static bool
+feed_decode(const uint8_t *z, unsigned zl, uint8_t *out, unsigned len,
+            unsigned chunk, unsigned first)
+{
+	struct feed f = {
+		.src = { .refill = feed_refill },
+		.p = z, .e = z + zl,
+		.chunk = chunk, .first = first,
+	};
+
+	/* Must decode from exactly all the bytes, nothing left */
+	return lzd_decode(&f.src, out, len) && (f.src.p == f.src.e) && (f.p == f.e);
+}
+
+static int
+check_block(const uint8_t *z, unsigned zl, const uint8_t *ref, unsigned len, bool full)
+{
+	static const unsigned chunks[] = { 1, 2, 3, 5, 61, 64, 4096 };
+	uint8_t blk[LZD_BLK_LEN];
+	unsigned i;
+
+	/* Fixed size refills */
+	for (i=0; i<sizeof(chunks)/sizeof(chunks[0]); i++) {
+		memset(blk, 0xa5, sizeof(blk));
+		if (!feed_decode(z, zl, blk, len, chunks[i], 0) || memcmp(blk, ref, len)) {
+			fprintf(stderr, "Chunked (%d) decode error\n", chunks[i]);
+			return -1;
+		}
+	}
+
+	if (!full)
+		return 0;
+
+	/* Split in two at every offset, and truncated at every offset */
+	for (i=1; i<zl; i++) {
+		memset(blk, 0xa5, sizeof(blk));
+		if (!feed_decode(z, zl, blk, len, zl, i) || memcmp(blk, ref, len)) {
+			fprintf(stderr, "Split (%d) decode error\n", i);
+			return -1;
+		}
+
+		if (feed_decode(z, i, blk, len, 64, 0)) {
+			fprintf(stderr, "Truncated (%d / %d) block accepted\n", i, zl);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Hand made streams, all decoding to 16 bytes */
+#define L16	0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15
+#define A16	'A','A','A','A','A','A','A','A','A','A','A','A','A','A','A','A'
+
+static const struct {
+	const char *name;
+	bool ok;
+	unsigned zl;
+	uint8_t z[20];
+	uint8_t ref[16];
+} vectors[] = {
+	{ "literals",            true,  17, { 0x0f, L16 },              { L16 } },
+	{ "run",                 true,   5, { 0x00, 'A', 0x8c, 1, 0 },  { A16 } },
+	{ "empty",               false,  0, { } },
+	{ "truncated literals",  false,  8, { 0x0f, L16 } },
+	{ "truncated distance",  false,  4, { 0x00, 'A', 0x8c, 1, 0 } },
+	{ "missing token",       false,  5, { 0x00, 'A', 0x8b, 1, 0 } },
+	{ "distance 0",          false,  5, { 0x00, 'A', 0x8c, 0, 0 } },
+	{ "distance past start", false,  5, { 0x00, 'A', 0x8c, 2, 0 } },
+	{ "distance past block", false,  5, { 0x00, 'A', 0x8c, 0, 0x10 } },
+	{ "overlong match",      false,  5, { 0x00, 'A', 0x8d, 1, 0 } },
+	{ "overlong literals",   false, 18, { 0x10, L16, 0 } },
+	{ "trailing data",       false,  6, { 0x00, 'A', 0x8c, 1, 0, 0 } },
+};
+
+static int
+self_test(void)
+{
+	uint8_t out[16];
+	unsigned i, c;
+	int rv = 0;
+
+	for (i=0; i<sizeof(vectors)/sizeof(vectors[0]); i++)
+	{
+		/* Whole, and one byte at a time */
+		for (c=1; c<=64; c+=63)
+		{
+			bool ok = feed_decode(vectors[i].z, vectors[i].zl, out, sizeof(out), c, 0);
+
+			/* Corrupt streams must be refused, whatever they output */
+			if (ok && vectors[i].ok)
+				ok = !memcmp(out, vectors[i].ref, sizeof(out));
+
+			if (ok != vectors[i].ok) {
+				fprintf(stderr, "Self test '%s' (chunk %d) : %s\n",
+					vectors[i].name, c, vectors[i].ok ? "failed" : "accepted");
+				rv = 1;
+			}
+		}
+	}
+
+	if (!rv)
+		printf("Self test: OK\n");
+
+	return rv;
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint8_t blk[LZD_BLK_LEN];
+	struct lzd_src src = { 0 };
+	uint8_t *zd, *rd, *zp, *ze;
+	long zl, rl, ofs;
+
+	if (argc == 1)
+		return self_test();
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s [<compressed> <original>]\n", argv[0]);
+		return 1;
+	}
+
+	zd = load(argv[1], &zl);
+	rd = load(argv[2], &rl);
+	zp = zd;
+	ze = zd + zl;
+
+	if ((zl < LZD_HDR_LEN) || (le(zp, 4) != LZD_MAGIC) || (le(zp + 4, 4) != rl)) {
+		fprintf(stderr, "Bad header\n");
+		return 1;
+	}
+	zp += LZD_HDR_LEN;
+
+	for (ofs=0; ofs<rl; ofs+=LZD_BLK_LEN)
+	{
+		unsigned clen, len = (rl - ofs) < LZD_BLK_LEN ? (rl - ofs) : LZD_BLK_LEN;
+
+		if ((ze - zp) < 2 || (clen = le(zp, 2), (ze - zp - 2) < clen)) {
+			fprintf(stderr, "Truncated stream @ %ld\n", ofs);
+			return 1;
+		}
+
+		/* Block must decode exactly from its own bytes */
+		src.p = zp + 2;
+		src.e = zp + 2 + clen;
+
+		if (!lzd_decode(&src, blk, len) || (src.p != src.e)) {
+			fprintf(stderr, "Decode error @ %ld\n", ofs);
+			return 1;
+		}
+
+		if (memcmp(blk, &rd[ofs], len)) {
+			fprintf(stderr, "Mismatch @ %ld\n", ofs);
+			return 1;
+		}
+
+		/* Same through refills. Splits are slow, first and last blocks only */
+		if (check_block(zp + 2, clen, &rd[ofs], len, (ofs < 2 * LZD_BLK_LEN) || (len < LZD_BLK_LEN))) {
+			fprintf(stderr, " @ %ld\n", ofs);
+			return 1;
+		}
+
+		zp += 2 + clen;
+	}
+
+	if (zp != ze) {
+		fprintf(stderr, "Trailing data\n");
+		return 1;
+	}
+
+	printf("%s: OK (%ld -> %ld bytes)\n", argv[2], rl, zl);
+
+	return 0;
+}
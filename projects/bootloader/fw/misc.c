@@ -25,6 +25,7 @@
 
 #include "config.h"
 #include "misc.h"
+#include "spi.h"
 
 
 struct had_misc {
@@ -48,11 +49,15 @@ flashchip_select(int flash_sel)
 	// the output of that flipflop is low, the internal flash is selected,
 	// otherwise the external flash. The flipflop is connected to two bits in
 	//the ctrl reg: 14 is clock, 13 is data.
+	// Not in the middle of a DMA transfer
+	spi_wait_idle();
+
 	int v=had_misc_regs->ctrl&~((1<<14)|(1<<13));
 	if (flash_sel==FLASHCHIP_CART) v|=(1<<13);
 	had_misc_regs->ctrl = v;
 	had_misc_regs->ctrl = v | (1<<14);
 	had_misc_regs->ctrl = v;
+	flash_chip_switched(flash_sel);
 }
 
 
@@ -97,7 +102,11 @@ led_set_pwm(int n, int level)
 void __attribute__((noreturn))
 reboot_now(void)
 {
+	/* Config logic and the apps expect the flashes in SPI mode */
+	flashchip_select(FLASHCHIP_CART);
+	flash_qpi_exit();
 	flashchip_select(FLASHCHIP_INTERNAL);
+	flash_qpi_exit();
 	had_misc_regs->ctrl = (had_misc_regs->ctrl & 0x00ffffff) | 0xa5000000;
 	while (1);
 }
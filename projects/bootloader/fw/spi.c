@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "config.h"
 #include "spi.h"
@@ -31,9 +32,48 @@
 struct spi {
 	uint32_t csr;
 	uint32_t data;
+	uint32_t poll;
+	uint32_t pdata;
+	uint32_t seq_addr;
+	uint32_t seq_len;
+	uint32_t seq_cmd;
+	uint32_t dma;
 } __attribute__((packed,aligned(4)));
 
 static volatile struct spi * const spi_regs = (void*)(SPI_BASE);
+#ifdef XIP_BASE
+static volatile uint32_t * const xip_mem = (void*)(XIP_BASE);
+#endif
+
+#define SPI_SEQ_BUSY		(1 << 31)
+#define SPI_SEQ_READ		(1 << 30)
+#define SPI_SEQ_QUAD_CMD	(1 << 29)
+#define SPI_SEQ_QUAD_ADDR	(1 << 28)
+#define SPI_SEQ_QUAD_DATA	(1 << 27)
+#define SPI_SEQ_CS(n)		((n) << 24)
+#define SPI_SEQ_ADDR_LEN(n)	((n) << 22)
+#define SPI_SEQ_FAST		(1 << 21)
+#define SPI_SEQ_DUMMY(n)	((n) << 16)
+#define SPI_SEQ_ADDR24		SPI_SEQ_ADDR_LEN(3)
+#define SPI_SEQ_QPI		(SPI_SEQ_QUAD_CMD | SPI_SEQ_QUAD_ADDR | SPI_SEQ_QUAD_DATA)
+
+/* Clock used for data transfers, short commands stay at 24 MHz */
+#ifdef SPI_FAST_CLK
+#define SPI_SEQ_BULK		SPI_SEQ_FAST
+#else
+#define SPI_SEQ_BULK		0
+#endif
+
+#define SPI_CSR_FLASH_QPI	(1 << 24)
+
+#define SPI_DMA_ENA		(1 << 31)
+
+static struct {
+	int chip;		/* Currently selected flash chip */
+	uint8_t qpi;		/* Bit mask of the chips in QPI mode */
+	uint8_t xip_stale;	/* Bit mask of the chips with a program / erase
+				 * issued, XIP cache to drop once done */
+} g_flash;
 
 
 void
@@ -43,9 +83,30 @@ spi_init(void)
 	flash_wake_up();
 }
 
+static void
+_spi_seq_wait(void)
+{
+	while (spi_regs->seq_cmd & SPI_SEQ_BUSY);
+}
+
+bool
+spi_busy(void)
+{
+	/* Sequencer and DMA included */
+	return (spi_regs->seq_cmd & SPI_SEQ_BUSY) != 0;
+}
+
+void
+spi_wait_idle(void)
+{
+	_spi_seq_wait();
+}
+
 void
 spi_xfer(unsigned cs, struct spi_xfer_chunk *xfer, unsigned n)
 {
+	_spi_seq_wait();
+
 	/* CS low */
 	spi_regs->csr &= ~(1 << (16+cs));
 
@@ -69,6 +130,70 @@ spi_xfer(unsigned cs, struct spi_xfer_chunk *xfer, unsigned n)
 	spi_regs->csr |= (1 << (16+cs));
 }
 
+static void
+_spi_seq(uint32_t cmd, uint32_t addr, unsigned len)
+{
+	/* Hardware runs the whole transaction, data goes through the
+	 * FIFOs with _spi_seq_write / _spi_seq_read */
+	_spi_seq_wait();
+	spi_regs->seq_addr = addr;
+	spi_regs->seq_len  = len;
+	spi_regs->seq_cmd  = cmd;
+}
+
+static void
+_spi_seq_write(const uint8_t *p, unsigned len)
+{
+	/* 4 bytes per store when aligned */
+	if (!((uint32_t)p & 3))
+		for (; len >= 4; len-=4, p+=4)
+			spi_regs->pdata = *(const uint32_t *)p;
+
+	while (len--)
+		spi_regs->data = *p++;
+
+	_spi_seq_wait();
+}
+
+static void
+_spi_seq_read(uint8_t *p, unsigned len)
+{
+	/* Packed reads stall until 4 bytes are in */
+	if (!((uint32_t)p & 3))
+		for (; len >= 4; len-=4, p+=4)
+			*(uint32_t *)p = spi_regs->pdata;
+
+	while (len) {
+		uint32_t d = spi_regs->data;
+		if (!(d & 0x80000000)) {
+			*p++ = d;
+			len--;
+		}
+	}
+
+	_spi_seq_wait();
+}
+
+static void
+_spi_seq_dma(uint32_t cmd, uint32_t addr, void *buf, unsigned len)
+{
+	/* The DMA only does whole words of BRAM, anything else goes
+	 * through the FIFOs and is done on return */
+	if (((uint32_t)buf | len) & 3) {
+		_spi_seq(cmd, addr, len);
+		if (cmd & SPI_SEQ_READ)
+			_spi_seq_read(buf, len);
+		else
+			_spi_seq_write(buf, len);
+		return;
+	}
+
+	/* Data from / to BRAM, returns right away */
+	_spi_seq_wait();
+	spi_regs->dma = SPI_DMA_ENA | (uint32_t)buf;
+	_spi_seq(cmd, addr, len);
+}
+
 
 #define FLASH_CMD_RESET_ENABLE		0x66
 #define FLASH_CMD_RESET_EXECUTE		0x99
@@ -77,9 +202,12 @@ spi_xfer(unsigned cs, struct spi_xfer_chunk *xfer, unsigned n)
 #define FLASH_CMD_WRITE_ENABLE		0x06
 #define FLASH_CMD_WRITE_ENABLE_VOLATILE	0x50
 #define FLASH_CMD_WRITE_DISABLE		0x04
+#define FLASH_CMD_SUSPEND		0x75
+#define FLASH_CMD_RESUME		0x7a
 
 #define FLASH_CMD_QPI_ENTER		0x38
 #define FLASH_CMD_QPI_EXIT		0xff
+#define FLASH_CMD_SET_READ_PARAMS	0xc0
 
 #define FLASH_CMD_READ_MANUF_ID		0x9f
 #define FLASH_CMD_READ_UNIQUE_ID	0x4b
@@ -92,6 +220,9 @@ spi_xfer(unsigned cs, struct spi_xfer_chunk *xfer, unsigned n)
 #define FLASH_CMD_WRITE_SR3		0x11
 
 #define FLASH_CMD_READ_DATA		0x03
+#define FLASH_CMD_FAST_READ		0x0b
+#define FLASH_CMD_FAST_READ_QUAD_OUT	0x6b
+#define FLASH_CMD_FAST_READ_QUAD_IO	0xeb
 #define FLASH_CMD_PAGE_PROGRAM		0x02
 #define FLASH_CMD_QUAD_PAGE_PROGRAM	0x32
 #define FLASH_CMD_CHIP_ERASE		0x60
@@ -99,18 +230,51 @@ spi_xfer(unsigned cs, struct spi_xfer_chunk *xfer, unsigned n)
 #define FLASH_CMD_BLOCK_ERASE_32k	0x52
 #define FLASH_CMD_BLOCK_ERASE_64k	0xd8
 
+static bool
+_flash_qpi(void)
+{
+	return (g_flash.qpi >> g_flash.chip) & 1;
+}
+
+static uint32_t
+_flash_seq(void)
+{
+	/* In QPI, every phase of every command is 4 bit */
+	return SPI_SEQ_CS(SPI_CS_FLASH) | (_flash_qpi() ? SPI_SEQ_QPI : 0);
+}
+
+static void
+_flash_qpi_set(bool qpi)
+{
+	if (qpi)
+		g_flash.qpi |=  (1 << g_flash.chip);
+	else
+		g_flash.qpi &= ~(1 << g_flash.chip);
+
+	/* Hardware poller and XIP fills follow the mode */
+	spi_regs->csr = (spi_regs->csr & ~SPI_CSR_FLASH_QPI) | (qpi ? SPI_CSR_FLASH_QPI : 0);
+}
+
+void
+flash_chip_switched(int chip)
+{
+	g_flash.chip = chip;
+	_flash_qpi_set(_flash_qpi());
+	flash_xip_invalidate();
+}
+
 void
 flash_cmd(uint8_t cmd)
 {
-	struct spi_xfer_chunk xfer[1] = {
-		{ .data = (void*)&cmd, .len = 1, .read = false, .write = true,  },
-	};
-	spi_xfer(SPI_CS_FLASH, xfer, 1);
+	_spi_seq(_flash_seq() | cmd, 0, 0);
+	_spi_seq_wait();
 }
 
 void
 flash_cmd_qpi(uint8_t cmd)
 {
+	_spi_seq_wait();
+
 	/* CS low */
 	spi_regs->csr &= ~(1 << 16);
 
@@ -129,6 +293,7 @@ flash_reset(void)
 {
 	/* Send 'Exit QPI' in quad mode */
 	flash_cmd_qpi(FLASH_CMD_QPI_EXIT);
+	_flash_qpi_set(false);
 
 	/* Soft reset */
 	flash_cmd(FLASH_CMD_RESET_ENABLE);
@@ -168,17 +333,18 @@ flash_write_disable(void)
 void
 flash_manuf_id(void *manuf)
 {
-	uint8_t cmd = FLASH_CMD_READ_MANUF_ID;
-	struct spi_xfer_chunk xfer[2] = {
-		{ .data = (void*)&cmd,  .len = 1, .read = false, .write = true,  },
-		{ .data = (void*)manuf, .len = 3, .read = true,  .write = false, },
-	};
-	spi_xfer(SPI_CS_FLASH, xfer, 2);
+	_spi_seq(_flash_seq() | SPI_SEQ_READ | FLASH_CMD_READ_MANUF_ID, 0, 3);
+	_spi_seq_read(manuf, 3);
 }
 
 void
 flash_unique_id(void *id)
 {
+	/* No QPI variant */
+	bool qpi = _flash_qpi();
+	if (qpi)
+		flash_qpi_exit();
+
 	uint8_t cmd = FLASH_CMD_READ_UNIQUE_ID;
 	struct spi_xfer_chunk xfer[3] = {
 		{ .data = (void*)&cmd, .len = 1, .read = false, .write = true,  },
@@ -186,90 +352,242 @@ flash_unique_id(void *id)
 		{ .data = (void*)id,   .len = 8, .read = true,  .write = false, },
 	};
 	spi_xfer(SPI_CS_FLASH, xfer, 3);
+
+	if (qpi)
+		flash_qpi_enter();
+}
+
+bool
+flash_qpi_enter(void)
+{
+	uint8_t id[2][3];
+
+	if (_flash_qpi())
+		return true;
+
+	/* Needs QE set, check the chip answers the same in QPI. A missing
+	 * one reads as all 1s either way */
+	flash_manuf_id(id[0]);
+	if ((id[0][0] == 0x00) || (id[0][0] == 0xff))
+		return false;
+
+	flash_cmd(FLASH_CMD_QPI_ENTER);
+	_flash_qpi_set(true);
+
+	flash_manuf_id(id[1]);
+	if (memcmp(id[0], id[1], 3)) {
+		flash_qpi_exit();
+		return false;
+	}
+
+	/* 6 dummy clocks for fast reads, see _flash_read() */
+	uint8_t p = 0x20;
+	_spi_seq(_flash_seq() | FLASH_CMD_SET_READ_PARAMS, 0, 1);
+	_spi_seq_write(&p, 1);
+
+	return true;
+}
+
+bool
+flash_qpi_active(void)
+{
+	/* Any chip in QPI */
+	return g_flash.qpi != 0;
+}
+
+void
+flash_qpi_exit(void)
+{
+	if (!_flash_qpi())
+		return;
+
+	flash_cmd_qpi(FLASH_CMD_QPI_EXIT);
+	_flash_qpi_set(false);
+}
+
+static void
+_flash_xip_done(void)
+{
+	/* Only once the flash is done, lines fetched before or during the
+	 * operation are all stale */
+	if (g_flash.xip_stale & (1 << g_flash.chip)) {
+		g_flash.xip_stale &= ~(1 << g_flash.chip);
+		flash_xip_invalidate();
+	}
+}
+
+static uint8_t
+_flash_read_sr(void)
+{
+	uint8_t rv;
+	_spi_seq(_flash_seq() | SPI_SEQ_READ | FLASH_CMD_READ_SR1, 0, 1);
+	_spi_seq_read(&rv, 1);
+	return rv;
 }
 
 uint8_t
 flash_read_sr(void)
 {
-	uint8_t cmd = FLASH_CMD_READ_SR1;
-	uint8_t rv;
-	struct spi_xfer_chunk xfer[2] = {
-		{ .data = (void*)&cmd, .len = 1, .read = false, .write = true,  },
-		{ .data = (void*)&rv,  .len = 1, .read = true,  .write = false, },
-	};
-	spi_xfer(SPI_CS_FLASH, xfer, 2);
+	uint8_t rv = _flash_read_sr();
+	if (!(rv & 1))
+		_flash_xip_done();
 	return rv;
 }
 
+void
+flash_wait_start(unsigned interval)
+{
+	/* Hardware polls SR1 every 'interval' clk until WIP clears. This
+	 * also raises the SPI IRQ once done, until flash_wait_ack() */
+	spi_regs->poll = (1 << 31) | (1 << 30) | (1 << (16+SPI_CS_FLASH)) | interval;
+}
+
+bool
+flash_wait_done(void)
+{
+	if (!(spi_regs->csr & (1 << 25)))
+		return false;
+	_flash_xip_done();
+	return true;
+}
+
+void
+flash_wait_ack(void)
+{
+	/* Ready flag is kept */
+	spi_regs->poll = 0;
+}
+
+void
+flash_suspend(void)
+{
+	/* The poller would see the chip idle, stop it. 'ready' stays
+	 * clear until flash_resume() */
+	spi_regs->poll = 0;
+
+	flash_cmd(FLASH_CMD_SUSPEND);
+
+	/* WIP clears once suspended (tSUS, 20 us max), not done though */
+	while (_flash_read_sr() & 1);
+}
+
+void
+flash_resume(unsigned interval)
+{
+	flash_cmd(FLASH_CMD_RESUME);
+
+	/* Back to waiting for completion */
+	flash_wait_start(interval);
+}
+
 void
 flash_write_sr(uint8_t srno, uint8_t sr)
 {
-	uint8_t cmd[2] = { 0, sr };
-	if (srno==1) cmd[0]=FLASH_CMD_WRITE_SR1;
-	if (srno==2) cmd[0]=FLASH_CMD_WRITE_SR2;
-	if (srno==3) cmd[0]=FLASH_CMD_WRITE_SR3;
-	if (cmd[0]==0) return;
-	struct spi_xfer_chunk xfer[1] = {
-		{ .data = (void*)cmd, .len = 2, .read = false, .write = true,  },
-	};
-	spi_xfer(SPI_CS_FLASH, xfer, 1);
+	uint8_t cmd = 0;
+	if (srno==1) cmd=FLASH_CMD_WRITE_SR1;
+	if (srno==2) cmd=FLASH_CMD_WRITE_SR2;
+	if (srno==3) cmd=FLASH_CMD_WRITE_SR3;
+	if (cmd==0) return;
+	_spi_seq(_flash_seq() | cmd, 0, 1);
+	_spi_seq_write(&sr, 1);
+}
+
+void
+flash_xip_invalidate(void)
+{
+#ifdef XIP_BASE
+	/* Any write drops all the cached lines */
+	*xip_mem = 0;
+#endif
+}
+
+static uint32_t
+_flash_read_cmd(uint32_t cmd)
+{
+	/* All reads are the same in QPI : 0x0B with the 6 dummy clocks
+	 * set by flash_qpi_enter() */
+	if (_flash_qpi())
+		cmd = SPI_SEQ_QPI | SPI_SEQ_DUMMY(3) | FLASH_CMD_FAST_READ;
+
+	return SPI_SEQ_CS(SPI_CS_FLASH) | SPI_SEQ_BULK | SPI_SEQ_READ | SPI_SEQ_ADDR24 | cmd;
+}
+
+static void
+_flash_read(uint32_t cmd, void *dst, uint32_t addr, unsigned len)
+{
+	_spi_seq(_flash_read_cmd(cmd), addr, len);
+	_spi_seq_read(dst, len);
 }
 
 void
 flash_read(void *dst, uint32_t addr, unsigned len)
 {
-	uint8_t cmd[4] = { FLASH_CMD_READ_DATA, ((addr >> 16) & 0xff), ((addr >> 8) & 0xff), (addr & 0xff)  };
-	struct spi_xfer_chunk xfer[2] = {
-		{ .data = (void*)cmd, .len = 4,   .read = false, .write = true,  },
-		{ .data = (void*)dst, .len = len, .read = true,  .write = false, },
-	};
-	spi_xfer(SPI_CS_FLASH, xfer, 2);
+	_flash_read(FLASH_CMD_READ_DATA, dst, addr, len);
 }
 
 void
-flash_page_program(void *src, uint32_t addr, unsigned len)
+flash_quad_read(void *dst, uint32_t addr, unsigned len)
 {
-	uint8_t cmd[4] = { FLASH_CMD_PAGE_PROGRAM, ((addr >> 16) & 0xff), ((addr >> 8) & 0xff), (addr & 0xff)  };
-	struct spi_xfer_chunk xfer[2] = {
-		{ .data = (void*)cmd, .len = 4,   .read = false, .write = true, },
-		{ .data = (void*)src, .len = len, .read = false, .write = true, },
-	};
-	spi_xfer(SPI_CS_FLASH, xfer, 2);
+	/* 8 dummy clocks, data on all 4 lines */
+	_flash_read(SPI_SEQ_QUAD_DATA | SPI_SEQ_DUMMY(1) | FLASH_CMD_FAST_READ_QUAD_OUT, dst, addr, len);
 }
 
 void
-flash_quad_page_program(void *src, uint32_t addr, unsigned len)
+flash_quad_io_read(void *dst, uint32_t addr, unsigned len)
 {
-	uint8_t *p = src;
+	/* Address in 4 bit mode, then M7-0 = 0x00 (no continuous read)
+	 * and 4 dummy clocks, all 3 sent as quad dummy bytes */
+	_flash_read(SPI_SEQ_QUAD_ADDR | SPI_SEQ_QUAD_DATA | SPI_SEQ_DUMMY(3) | FLASH_CMD_FAST_READ_QUAD_IO, dst, addr, len);
+}
 
-	/* CS low */
-	spi_regs->csr &= ~(1 << 16);
+void
+flash_quad_io_read_async(void *dst, uint32_t addr, unsigned len)
+{
+	/* Same, by DMA. Done once spi_busy() clears */
+	_spi_seq_dma(_flash_read_cmd(SPI_SEQ_QUAD_ADDR | SPI_SEQ_QUAD_DATA | SPI_SEQ_DUMMY(3) | FLASH_CMD_FAST_READ_QUAD_IO), addr, dst, len);
+}
 
-	/* Command and address */
-	spi_regs->data = FLASH_CMD_QUAD_PAGE_PROGRAM;
-	spi_regs->data = (addr >> 16) & 0xff;
-	spi_regs->data = (addr >>  8) & 0xff;
-	spi_regs->data = (addr      ) & 0xff;
+void
+flash_page_program(void *src, uint32_t addr, unsigned len)
+{
+	g_flash.xip_stale |= (1 << g_flash.chip);
+	_spi_seq(_flash_seq() | SPI_SEQ_BULK | SPI_SEQ_ADDR24 | FLASH_CMD_PAGE_PROGRAM, addr, len);
+	_spi_seq_write(src, len);
+}
 
-	/* All bytes in Quad Write mode */
-	while (len--)
-		spi_regs->data = *p++ | 0x200;
+static uint32_t
+_flash_quad_prog_cmd(void)
+{
+	/* No 0x32 in QPI, plain page program is already all 4 bit there */
+	if (_flash_qpi())
+		return _flash_seq() | SPI_SEQ_BULK | SPI_SEQ_ADDR24 | FLASH_CMD_PAGE_PROGRAM;
 
-	/* Wait for completion */
-	while (!(spi_regs->csr & (1 << 27)));
+	return SPI_SEQ_CS(SPI_CS_FLASH) | SPI_SEQ_BULK | SPI_SEQ_QUAD_DATA | SPI_SEQ_ADDR24 | FLASH_CMD_QUAD_PAGE_PROGRAM;
+}
 
-	/* CS high */
-	spi_regs->csr |= (1 << 16);
+void
+flash_quad_page_program(void *src, uint32_t addr, unsigned len)
+{
+	g_flash.xip_stale |= (1 << g_flash.chip);
+	_spi_seq(_flash_quad_prog_cmd(), addr, len);
+	_spi_seq_write(src, len);
+}
+
+void
+flash_quad_page_program_async(void *src, uint32_t addr, unsigned len)
+{
+	/* Same, by DMA. 'src' must stay untouched until spi_busy() clears,
+	 * flash_wait_start() can be called right away */
+	g_flash.xip_stale |= (1 << g_flash.chip);
+	_spi_seq_dma(_flash_quad_prog_cmd(), addr, src, len);
 }
 
 static void
 _flash_erase(uint8_t cmd_byte, uint32_t addr)
 {
-	uint8_t cmd[4] = { cmd_byte, ((addr >> 16) & 0xff), ((addr >> 8) & 0xff), (addr & 0xff)  };
-	struct spi_xfer_chunk xfer[1] = {
-		{ .data = (void*)cmd, .len = 4,   .read = false, .write = true,  },
-	};
-	spi_xfer(SPI_CS_FLASH, xfer, 1);
+	g_flash.xip_stale |= (1 << g_flash.chip);
+	_spi_seq(_flash_seq() | SPI_SEQ_ADDR24 | cmd_byte, addr, 0);
+	_spi_seq_wait();
 }
 
 void
@@ -304,32 +622,57 @@ flash_write_protect_bootloader()
 
 #define PSRAM_CMD_WRITE	0x02
 #define PSRAM_CMD_READ	0x03
+#define PSRAM_CMD_FAST_READ	0x0b
+
+/* The PSRAM can't self-refresh while selected, CS low time is limited
+ * (tCEM, 8 us). Budget 7 us for FIFO stalls, minus cmd / addr / dummy */
+#ifdef SPI_FAST_CLK
+#define PSRAM_SCK_MHZ		48
+#else
+#define PSRAM_SCK_MHZ		24
+#endif
+#define PSRAM_BURST		((((7 * PSRAM_SCK_MHZ) / 8) - 5) & ~3)
 
 void
 psram_read(int id, void *dst, uint32_t addr, unsigned len)
 {
-	uint8_t cmd[4] = { PSRAM_CMD_READ, ((addr >> 16) & 0xff), ((addr >> 8) & 0xff), (addr & 0xff)  };
-	struct spi_xfer_chunk xfer[2] = {
-		{ .data = (void*)cmd, .len = 4,   .read = false, .write = true,  },
-		{ .data = (void*)dst, .len = len, .read = true,  .write = false, },
-	};
-	spi_xfer(SPI_CS_PSRAMA + id, xfer, 2);
+	uint8_t *d = dst;
+
+	while (len) {
+		unsigned l = (len > PSRAM_BURST) ? PSRAM_BURST : len;
+
+		/* 0x03 is limited to 33 MHz, 0x0B has 8 wait cycles but no limit */
+		_spi_seq(SPI_SEQ_CS(SPI_CS_PSRAMA + id) | SPI_SEQ_BULK | SPI_SEQ_READ | SPI_SEQ_ADDR24 | SPI_SEQ_DUMMY(1) | PSRAM_CMD_FAST_READ, addr, l);
+		_spi_seq_read(d, l);
+
+		d    += l;
+		addr += l;
+		len  -= l;
+	}
 }
 
 void
 psram_write(int id, void *dst, uint32_t addr, unsigned len)
 {
-	uint8_t cmd[4] = { PSRAM_CMD_WRITE, ((addr >> 16) & 0xff), ((addr >> 8) & 0xff), (addr & 0xff)  };
-	struct spi_xfer_chunk xfer[2] = {
-		{ .data = (void*)cmd, .len = 4,   .read = false, .write = true,  },
-		{ .data = (void*)dst, .len = len, .read = false, .write = true, },
-	};
-	spi_xfer(SPI_CS_PSRAMA + id, xfer, 2);
+	uint8_t *d = dst;
+
+	while (len) {
+		unsigned l = (len > PSRAM_BURST) ? PSRAM_BURST : len;
+
+		_spi_seq(SPI_SEQ_CS(SPI_CS_PSRAMA + id) | SPI_SEQ_BULK | SPI_SEQ_ADDR24 | PSRAM_CMD_WRITE, addr, l);
+		_spi_seq_write(d, l);
+
+		d    += l;
+		addr += l;
+		len  -= l;
+	}
 }
 
 void
 psram_qpi_exit(int id)
 {
+	_spi_seq_wait();
+
 	/* CS low */
 	spi_regs->csr &= ~(1 << (17+id));
 
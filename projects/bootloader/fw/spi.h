@@ -38,10 +38,16 @@ struct spi_xfer_chunk {
 
 void spi_init(void);
 void spi_xfer(unsigned cs, struct spi_xfer_chunk *xfer, unsigned n);
+bool spi_busy(void);
+void spi_wait_idle(void);
 
 void flash_cmd(uint8_t cmd);
 void flash_cmd_qpi(uint8_t cmd);
 void flash_reset(void);
+void flash_chip_switched(int chip);
+bool flash_qpi_enter(void);
+void flash_qpi_exit(void);
+bool flash_qpi_active(void);
 void flash_deep_power_down(void);
 void flash_wake_up(void);
 void flash_write_enable(void);
@@ -49,10 +55,23 @@ void flash_write_disable(void);
 void flash_manuf_id(void *manuf);
 void flash_unique_id(void *id);
 uint8_t flash_read_sr(void);
+void flash_wait_start(unsigned interval);
+bool flash_wait_done(void);
+void flash_wait_ack(void);
+void flash_suspend(void);
+void flash_resume(unsigned interval);
 void flash_write_sr(uint8_t srno, uint8_t sr);
+void flash_xip_invalidate(void);
 void flash_read(void *dst, uint32_t addr, unsigned len);
+void flash_quad_read(void *dst, uint32_t addr, unsigned len);
+void flash_quad_io_read(void *dst, uint32_t addr, unsigned len);
+/* By DMA when 'dst' is word aligned and 'len' a multiple of 4, buffer in
+ * use until spi_busy() clears. Otherwise falls back to a blocking read */
+void flash_quad_io_read_async(void *dst, uint32_t addr, unsigned len);
 void flash_page_program(void *src, uint32_t addr, unsigned len);
 void flash_quad_page_program(void *src, uint32_t addr, unsigned len);
+/* Same alignment rules as flash_quad_io_read_async() */
+void flash_quad_page_program_async(void *src, uint32_t addr, unsigned len);
 void flash_sector_erase(uint32_t addr);
 void flash_block_erase_32k(uint32_t addr);
 void flash_block_erase_64k(uint32_t addr);
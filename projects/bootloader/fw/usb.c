@@ -384,7 +384,7 @@ usb_poll(void)
 
 	/* Active ? */
 	if (g_usb.state < USB_DS_CONNECTED)
-		return;
+		goto drop;
 
 	/* Read CSR */
 	csr = usb_regs->csr;
@@ -392,20 +392,20 @@ usb_poll(void)
 	/* Check for pending bus reset */
 	if (csr & USB_CSR_BUS_RST_PENDING) {
 		if (csr & USB_CSR_BUS_RST)
-			return;
+			goto drop;
 		usb_bus_reset();
 	}
 
 	/* If we've not been reset, only reset is of interest */
 	if (g_usb.state < USB_DS_DEFAULT)
-		return;
+		goto drop;
 
 	/* Supspend handling */
 	if (csr & USB_CSR_BUS_SUSPEND) {
 		if (!(g_usb.state & USB_DS_SUSPENDED)) {
 			usb_set_state(USB_DS_SUSPENDED);
 		}
-		return;
+		goto drop;
 	} else if (g_usb.state & USB_DS_SUSPENDED) {
 		usb_set_state(USB_DS_RESUME);
 	}
@@ -426,6 +426,12 @@ usb_poll(void)
 
 	/* Poll EP0 (control) */
 	usb_ep0_poll();
+	return;
+
+drop:
+	/* Events are of no use here, but the USB IRQ is level and only
+	 * reading them clears it */
+	csr = usb_regs->evt;
 }
 
 void
@@ -90,11 +90,21 @@ struct usb_xfer {
 	int len;
 
 	/* Call backs */
-	usb_xfer_cb cb_data;	/* Data call back */
+	usb_xfer_cb cb_data;	/* Data call back, see below */
 	usb_xfer_cb cb_done;	/* Completion call back */
 	void *cb_ctx;
 };
 
+/*
+ * If 'cb_data' is set, the data stage can be longer than the buffer :
+ *  - OUT: called once the buffer can't fit another packet or all data
+ *         is in. It must consume 'ofs' bytes and make room (ofs = 0)
+ *  - IN : called once the buffer is all sent and the host wants more.
+ *         It must provide the next chunk in data / len / ofs, nothing
+ *         left ends the transfer
+ * Returning false stalls the request.
+ */
+
 
 /* API */
 void usb_init(const struct usb_stack_descriptors *stack_desc);
@@ -105,6 +105,14 @@ usb_ep0_setup_queue_data(void)
 
 /* Handle control transfers */
 
+static void
+usb_handle_control_stall(void)
+{
+	g_usb.ctrl.state = STALL;
+	usb_ep0_in_queue_stall();
+	usb_ep0_out_queue_stall();
+}
+
 static void
 usb_handle_control_data()
 {
@@ -112,8 +120,20 @@ usb_handle_control_data()
 	if (g_usb.ctrl.state == DATA_IN) {
 		/* How much left to do ? */
 		int xflen = g_usb.ctrl.xfer.len - g_usb.ctrl.xfer.ofs;
+
+		/* Streamed, ask for more */
+		if (!xflen && g_usb.ctrl.xfer.cb_data && g_usb.ctrl.left) {
+			if (!g_usb.ctrl.xfer.cb_data(&g_usb.ctrl.xfer)) {
+				usb_handle_control_stall();
+				return;
+			}
+			xflen = g_usb.ctrl.xfer.len - g_usb.ctrl.xfer.ofs;
+		}
+
 		if (xflen > EP0_PKT_LEN)
 			xflen = EP0_PKT_LEN;
+		if (xflen > g_usb.ctrl.left)
+			xflen = g_usb.ctrl.left;
 
 		/* Setup descriptor for output */
 		if (xflen)
@@ -122,9 +142,10 @@ usb_handle_control_data()
 
 		/* Move on */
 		g_usb.ctrl.xfer.ofs += xflen;
+		g_usb.ctrl.left -= xflen;
 
 		/* If we're done, setup the OUT ack */
-		if (xflen < EP0_PKT_LEN) {
+		if ((xflen < EP0_PKT_LEN) || !g_usb.ctrl.left) {
 			usb_ep0_out_queue_data();
 			g_usb.ctrl.state = STATUS_DONE_OUT;
 		}
@@ -143,13 +164,23 @@ usb_handle_control_data()
 
 			/* Move on */
 			g_usb.ctrl.xfer.ofs += xflen;
+			g_usb.ctrl.left -= xflen;
 
 			/* Done with that buffer */
 			usb_ep0_out_clear();
+
+			/* Streamed, drain once full or complete */
+			if (g_usb.ctrl.xfer.cb_data && (!g_usb.ctrl.left ||
+			    ((g_usb.ctrl.xfer.len - g_usb.ctrl.xfer.ofs) < EP0_PKT_LEN))) {
+				if (!g_usb.ctrl.xfer.cb_data(&g_usb.ctrl.xfer)) {
+					usb_handle_control_stall();
+					return;
+				}
+			}
 		}
 
 		/* Next ? */
-		if (g_usb.ctrl.xfer.ofs == g_usb.ctrl.xfer.len)
+		if (!g_usb.ctrl.left)
 		{
 			/* Done, ACK with a ZLP */
 			usb_ep0_in_queue_data(0);
@@ -184,8 +215,10 @@ usb_handle_control_request(struct usb_ctrl_req *req)
 		goto error;
 
 	/* Buffer size vs request size checks */
+	g_usb.ctrl.left = req->wLength;
+
 	if (req->wLength > g_usb.ctrl.xfer.len) {
-		if (!USB_REQ_IS_READ(req)) {
+		if (!USB_REQ_IS_READ(req) && !g_usb.ctrl.xfer.cb_data) {
 			/* If this is a OUT treansaction and no suitable buffer was
 			 * provided, there isn't much we can do ... */
 			USB_LOG_ERR("[!] Control request handler failed to provide enough buffer space");
@@ -203,9 +236,7 @@ usb_handle_control_request(struct usb_ctrl_req *req)
 
 	/* Error path */
 error:
-	g_usb.ctrl.state = STALL;
-	usb_ep0_in_queue_stall();
-	usb_ep0_out_queue_stall();
+	usb_handle_control_stall();
 	return;
 }
 
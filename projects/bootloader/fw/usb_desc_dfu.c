@@ -23,6 +23,7 @@
 
 #include "usb_proto.h"
 #include "usb.h"
+#include "usb_dfu.h"
 
 #define NULL ((void*)0)
 #define num_elem(a) (sizeof(a) / sizeof(a[0]))
@@ -71,6 +72,8 @@ static const struct {
 	struct usb_dfu_desc dfu_cart_ipl;
 	struct usb_intf_desc if_cart_tjftl;
 	struct usb_dfu_desc dfu_cart_tjftl;
+	struct usb_intf_desc if_composite;
+	struct usb_dfu_desc dfu_composite;
 	struct usb_intf_desc if_bootloader;
 	struct usb_dfu_desc dfu_bootloader;
 } __attribute__ ((packed)) _dfu_conf_desc = {
@@ -98,9 +101,9 @@ static const struct {
 	.dfu_fpga = {
 		.bLength		= sizeof(struct usb_dfu_desc),
 		.bDescriptorType	= USB_DT_DFU,
-		.bmAttributes		= 0x0d,
+		.bmAttributes		= 0x0f,
 		.wDetachTimeOut		= 1000,
-		.wTransferSize		= 4096,
+		.wTransferSize		= DFU_XFER_MAX,
 		.bcdDFUVersion		= 0x0101,
 	},
 	.if_riscv = {
@@ -117,9 +120,9 @@ static const struct {
 	.dfu_riscv = {
 		.bLength		= sizeof(struct usb_dfu_desc),
 		.bDescriptorType	= USB_DT_DFU,
-		.bmAttributes		= 0x0d,
+		.bmAttributes		= 0x0f,
 		.wDetachTimeOut		= 1000,
-		.wTransferSize		= 4096,
+		.wTransferSize		= DFU_XFER_MAX,
 		.bcdDFUVersion		= 0x0101,
 	},
 	.if_cart_fpga = {
@@ -136,9 +139,9 @@ static const struct {
 	.dfu_cart_fpga = {
 		.bLength		= sizeof(struct usb_dfu_desc),
 		.bDescriptorType	= USB_DT_DFU,
-		.bmAttributes		= 0x0d,
+		.bmAttributes		= 0x0f,
 		.wDetachTimeOut		= 1000,
-		.wTransferSize		= 4096,
+		.wTransferSize		= DFU_XFER_MAX,
 		.bcdDFUVersion		= 0x0101,
 	},
 	.if_cart_ipl = {
@@ -155,9 +158,9 @@ static const struct {
 	.dfu_cart_ipl = {
 		.bLength		= sizeof(struct usb_dfu_desc),
 		.bDescriptorType	= USB_DT_DFU,
-		.bmAttributes		= 0x0d,
+		.bmAttributes		= 0x0f,
 		.wDetachTimeOut		= 1000,
-		.wTransferSize		= 4096,
+		.wTransferSize		= DFU_XFER_MAX,
 		.bcdDFUVersion		= 0x0101,
 	},
 	.if_cart_tjftl = {
@@ -174,12 +177,12 @@ static const struct {
 	.dfu_cart_tjftl = {
 		.bLength		= sizeof(struct usb_dfu_desc),
 		.bDescriptorType	= USB_DT_DFU,
-		.bmAttributes		= 0x0d,
+		.bmAttributes		= 0x0f,
 		.wDetachTimeOut		= 1000,
-		.wTransferSize		= 4096,
+		.wTransferSize		= DFU_XFER_MAX,
 		.bcdDFUVersion		= 0x0101,
 	},
-	.if_bootloader = {
+	.if_composite = {
 		.bLength		= sizeof(struct usb_intf_desc),
 		.bDescriptorType	= USB_DT_INTF,
 		.bInterfaceNumber	= 0,
@@ -190,12 +193,31 @@ static const struct {
 		.bInterfaceProtocol	= 0x02,
 		.iInterface		= 10,
 	},
+	.dfu_composite = {
+		.bLength		= sizeof(struct usb_dfu_desc),
+		.bDescriptorType	= USB_DT_DFU,
+		.bmAttributes		= 0x0d,	/* No upload */
+		.wDetachTimeOut		= 1000,
+		.wTransferSize		= DFU_XFER_MAX,
+		.bcdDFUVersion		= 0x0101,
+	},
+	.if_bootloader = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= 0,
+		.bAlternateSetting	= 6,
+		.bNumEndpoints		= 0,
+		.bInterfaceClass	= 0xfe,
+		.bInterfaceSubClass	= 0x01,
+		.bInterfaceProtocol	= 0x02,
+		.iInterface		= 11,
+	},
 	.dfu_bootloader = {
 		.bLength		= sizeof(struct usb_dfu_desc),
 		.bDescriptorType	= USB_DT_DFU,
-		.bmAttributes		= 0x0d,
+		.bmAttributes		= 0x0f,
 		.wDetachTimeOut		= 1000,
-		.wTransferSize		= 4096,
+		.wTransferSize		= DFU_XFER_MAX,
 		.bcdDFUVersion		= 0x0101,
 	},
 };
@@ -25,17 +25,60 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "config.h"
+#include "irq.h"
+#include "lz_dec.h"
 #include "spi.h"
 #include "usb.h"
 #include "usb_dfu.h"
 #include "usb_dfu_proto.h"
 #include "misc.h"
+#include "utils.h"
 
 
 #define DFU_VENDOR_PROTO
 #define DFU_UTIL_SPEEDUP_WORDAROUND
+#define DFU_BLANK_CHECK
+#define DFU_DELTA_UPDATE
+#define DFU_COMPRESSED
+#define DFU_VERIFY
+#define DFU_COMPOSITE
+#define DFU_FLASH_SUSPEND
+#define DFU_ERASE_AHEAD
+#define DFU_RESUME
+#define DFU_CHIP_OVERLAP
+#undef DFU_FLASH_QPI	/* Only reboot_now() leaves QPI : any other reset
+			 * (PROGRAMN, crash, ...) keeps the flash in it and
+			 * the ECP5 can't configure until power cycled */
 #undef DFU_SOF_POLL_LIMIT
-#define DFU_HOST_POLL_MS		5
+#define DFU_HOST_POLL_MS		1	/* Minimum bwPollTimeout when busy */
+
+#define DFU_PSRAM_SIZE			(8 * 1024 * 1024)	/* Per chip */
+#define DFU_PSRAM_PAGE			1024			/* Accesses wrap within this */
+#define DFU_RING_BLOCKS			((2 * DFU_PSRAM_SIZE) / 4096)
+
+#define DFU_ERASE_4K_MS			45	/* Typical, W25Q128JV */
+#define DFU_ERASE_32K_MS		120
+#define DFU_ERASE_64K_MS		150
+#define DFU_PROG_4K_MS			12	/* 16 pages, incl. SW overhead */
+#define DFU_VERIFY_64K_MS		70	/* Read back + CRC */
+
+#define DFU_POLL_ERASE_CYCLES		48000	/* SR1 poll interval, 1 ms */
+#define DFU_POLL_PROG_CYCLES		4800	/* 100 us */
+#define DFU_IRQ_POLL_CYCLES		4800	/* Retry interval when not waiting on flash */
+#define DFU_SUSPEND_MIN_MS		4	/* Erase progress between suspends */
+#define DFU_ERASE_AHEAD_DEFAULT		0	/* 64k blocks, see usb_dfu_set_erase_ahead() */
+
+#define DFU_ALT_COMPOSITE		5
+#define DFU_COMP_MAGIC			0x43554644	/* "DFUC" */
+
+#if defined(DFU_COMPRESSED) && !defined(DFU_PSRAM_STAGING)
+# error "Compressed downloads are decoded from the PSRAM staging ring"
+#endif
+
+#if defined(DFU_CHIP_OVERLAP) && !(defined(DFU_COMPOSITE) && defined(DFU_PSRAM_STAGING))
+# error "Chip overlap looks ahead in the PSRAM staging ring for composite headers"
+#endif
 
 #if 0
 #include "console.h"
@@ -89,6 +132,7 @@ static const uint32_t dfu_valid_req[_DFU_MAX_STATE] = {
 	0,
 
 	/* dfuMANIFEST_SYNC */
+	(1 << USB_REQ_DFU_DETACH) |		/* Non-std */
 	(1 << USB_REQ_DFU_GETSTATUS) |
 	(1 << USB_REQ_DFU_GETSTATE) |
 	(1 << USB_REQ_DFU_ABORT) |
@@ -123,6 +167,17 @@ static struct {
 
 	uint8_t tick;
 
+	/* Measured latencies (ms), initialized with typical values */
+	struct {
+		uint16_t erase[3];	// 4k, 32k, 64k
+		uint16_t prog;		// 4k block
+		uint16_t vfy;		// 64k read back
+	} lat;
+
+#ifdef DFU_ERASE_AHEAD
+	uint32_t ahead;	// Erase ahead for the next download, in bytes
+#endif
+
 	struct {
 		uint8_t used;
 		uint8_t wr;
@@ -131,6 +186,54 @@ static struct {
 		uint8_t data[2][4096] __attribute__((aligned(4)));
 	} buf;
 
+#ifdef DFU_PSRAM_STAGING
+	/* When staging, buf.data[0] receives from USB and is pushed
+	 * to the PSRAM ring, buf.data[1] is pulled back for programming */
+	struct {
+		uint32_t wr;	// Byte offset in the 16M PSRAM space
+		uint32_t rd;	// Byte offset in the 16M PSRAM space
+		uint32_t used;	// Number of 4k blocks
+	} ring;
+#endif
+
+#ifdef DFU_COMPRESSED
+	/* Compressed stream, decoded block by block from the ring */
+	struct {
+		bool active;
+		uint16_t clen;	// Length of block being waited for, 0 if not read yet
+		uint32_t end;	// Flash address of the end of decoded data
+		uint32_t left;	// Decoded bytes left
+		uint32_t want;	// Bytes the decoder may still pull from the ring
+		struct lzd_src src;
+		uint8_t chunk[64];
+	} lz;
+#endif
+
+#ifdef DFU_COMPOSITE
+	/* Composite image, current segment */
+	struct {
+		bool active;
+		uint32_t start;	// Flash address of the segment start
+		uint32_t end;	// Flash address of the segment data end
+		uint32_t left;	// Bytes left, next block is a header if 0
+	} comp;
+#endif
+
+#ifdef DFU_CHIP_OVERLAP
+	/* Erases for the next composite segment when it's on the other
+	 * flash chip, done while this one is busy */
+	struct {
+		uint32_t peek;	// Ring offset of the next header, ~0 if none
+		uint32_t sel;	// Flash chip
+		uint32_t start;	// Segment start
+		uint32_t addr;	// Next address to erase
+		uint32_t end;	// End of what to erase
+		uint32_t t0;	// Start tick of last erase
+		uint32_t ms;	// Expected duration of last erase
+		bool busy;	// Last erase not seen completed
+	} xe;
+#endif
+
 	struct {
 		uint32_t addr_recv;
 		uint32_t addr_prog;
@@ -138,34 +241,1008 @@ static struct {
 		uint32_t addr_end;
 		uint32_t selected;
 
-		int op_ofs;
-		int op_len;
+		int op_ofs;
+		int op_len;
+#ifdef DFU_BLANK_CHECK
+		int op_chk;
+#endif
+
+		bool recv_done;
+
+		uint32_t erase_len;	// Planned size of next erase, 0 if none
+		uint32_t ahead;		// Erase up to that far ahead of addr_prog
+		uint32_t erase_t0;	// Start tick of last erase
+		uint32_t erase_ms;	// Expected duration of last erase
+		uint8_t  erase_idx;	// lat.erase[] index of last erase
+		bool erase_timed;	// Last erase completion not measured yet
+		uint32_t prog_t0;	// Start tick of the block program
+		uint8_t  prog_n;	// Pages programmed in the block
+		uint32_t susp_t;	// Tick of last erase start / resume / suspend
+		bool erasing;		// Last command was an erase
+
+#ifdef DFU_DELTA_UPDATE
+		bool delta;
+#endif
+#ifdef DFU_RESUME
+		uint32_t resume;	// Session starts that far in the zone
+#endif
+
+		enum {
+			FL_IDLE = 0,
+			FL_COMPARE,
+			FL_ERASE,
+			FL_PROGRAM,
+		} op;
+	} flash;
+
+	struct {
+		uint32_t addr;	// Next address to send
+		uint32_t left;	// Bytes left to send for the current request
+		int pf_ofs;	// Bytes already read ahead at 'addr'
+		uint8_t half;	// Buffer half used for read ahead
+	} up;
+
+	struct usb_dfu_stats stats;
+
+#ifdef DFU_VERIFY
+	struct {
+		struct usb_dfu_verify res;
+		uint32_t addr;	// Next address to read back
+		uint32_t end;	// End of the range to read back
+		uint32_t sel;	// Flash chip of the range
+		uint32_t crc;	// Expected crc_flash at the end of the range
+		uint32_t t0;	// Start tick of the range
+		uint32_t len;	// Length of the range
+	} vfy;
+#endif
+} g_dfu;
+
+static const struct {
+	uint32_t flashsel;
+	uint32_t start;
+	uint32_t end;
+} dfu_zones[7] = {
+	{ FLASHCHIP_INTERNAL, 0x00180000, 0x00300000 },	/* ECP5 bitstream */
+	{ FLASHCHIP_INTERNAL, 0x00300000, 0x00380000 },	/* RISC-V firmware */
+	{ FLASHCHIP_CART,     0x00000000, 0x00180000 },	/* Cart ECP5 bitstream */
+	{ FLASHCHIP_CART,     0x00180000, 0x00200000 },	/* Cart IPL region */
+	{ FLASHCHIP_CART,     0x00200000, 0x01000000 },	/* Cart filesystem region */
+	{ FLASHCHIP_INTERNAL, 0x00000000, 0x00000000 },	/* Composite image, see below */
+	{ FLASHCHIP_INTERNAL, 0x00000000, 0x00180000 },	/* Boot Loader */
+};
+
+#ifdef DFU_COMPOSITE
+/*
+ * Composite images are a sequence of segments, each made of a 4k header
+ * block followed by the data, padded with 0xff to a multiple of 4k.
+ * Segments can only target the zones before the composite alt, so never
+ * the bootloader itself. Only the sectors a segment covers are erased,
+ * so a few small segments also make a sparse update of a large zone.
+ */
+struct dfu_comp_hdr {
+	uint32_t magic;		// DFU_COMP_MAGIC
+	uint8_t  zone;		// Alt setting of the target zone
+	uint8_t  _rsvd[3];
+	uint32_t offset;	// From the zone start, 4k aligned
+	uint32_t len;		// Data length
+} __attribute__((packed));
+#endif
+
+
+#ifdef DFU_PSRAM_STAGING
+static void
+_dfu_ring_xfer(bool write, uint32_t ofs, uint8_t *data)
+{
+	/* Both PSRAMs form a single linear space, chip A first */
+	int id = ofs / DFU_PSRAM_SIZE;
+	uint32_t addr = ofs & (DFU_PSRAM_SIZE - 1);
+
+	/* Split at page boundaries, psram_*() also cut for tCEM */
+	for (int i=0; i<4096; i+=DFU_PSRAM_PAGE) {
+		if (write)
+			psram_write(id, &data[i], addr + i, DFU_PSRAM_PAGE);
+		else
+			psram_read(id, &data[i], addr + i, DFU_PSRAM_PAGE);
+	}
+}
+
+static void
+_dfu_ring_push(uint8_t *data)
+{
+	_dfu_ring_xfer(true, g_dfu.ring.wr, data);
+	g_dfu.ring.wr = (g_dfu.ring.wr + 4096) & (2 * DFU_PSRAM_SIZE - 1);
+	g_dfu.ring.used++;
+}
+
+static void
+_dfu_ring_pop(uint8_t *data)
+{
+	_dfu_ring_xfer(false, g_dfu.ring.rd, data);
+	g_dfu.ring.rd = (g_dfu.ring.rd + 4096) & (2 * DFU_PSRAM_SIZE - 1);
+	g_dfu.ring.used--;
+}
+
+#ifdef DFU_CHIP_OVERLAP
+static void
+_dfu_ring_peek(uint32_t ofs, uint8_t *data, unsigned len)
+{
+	/* Small read, 'ofs' is block aligned so won't cross pages */
+	psram_read(ofs / DFU_PSRAM_SIZE, data, ofs & (DFU_PSRAM_SIZE - 1), len);
+}
+#endif
+
+static void
+_dfu_ring_reset(void)
+{
+	g_dfu.ring.wr   = 0;
+	g_dfu.ring.rd   = 0;
+	g_dfu.ring.used = 0;
+}
+#endif
+
+static void
+_dfu_fail(enum dfu_status status)
+{
+	/* Drop whatever is left to write, the host has to start over */
+	g_dfu.state  = dfuERROR;
+	g_dfu.status = status;
+
+	g_dfu.buf.used = 0;
+	g_dfu.flash.ahead = 0;
+#ifdef DFU_CHIP_OVERLAP
+	g_dfu.xe.peek = ~0;
+	g_dfu.xe.end  = g_dfu.xe.addr;
+#endif
+#ifdef DFU_PSRAM_STAGING
+	_dfu_ring_reset();
+#else
+	g_dfu.buf.rd = g_dfu.buf.wr;
+#endif
+#ifdef DFU_VERIFY
+	g_dfu.vfy.res.state = DFU_VERIFY_FAIL;
+#endif
+}
+
+static void
+_dfu_recv_abort(void)
+{
+	/* Host gave up or is gone. Queued data is dropped, only the flash
+	 * operation in flight completes. Nothing must wait for more input
+	 * after this, a partial compressed block would never decode */
+	g_dfu.flash.recv_done = true;
+	g_dfu.flash.ahead = 0;
+#ifdef DFU_CHIP_OVERLAP
+	g_dfu.xe.peek = ~0;
+	g_dfu.xe.end  = g_dfu.xe.addr;
+#endif
+#ifdef DFU_PSRAM_STAGING
+	_dfu_ring_reset();
+#endif
+#ifdef DFU_COMPRESSED
+	g_dfu.lz.left = 0;
+#endif
+#ifdef DFU_COMPOSITE
+	g_dfu.comp.left = 0;
+#endif
+#ifdef DFU_VERIFY
+	/* Partial image, nothing to check */
+	g_dfu.vfy.res.state = DFU_VERIFY_FAIL;
+#endif
+}
+
+static void
+_dfu_lat_update(uint16_t *lat, uint32_t ms)
+{
+	/* Running average, ignoring outliers (host stalls, ...) */
+	if (ms > (4U * *lat))
+		return;
+	*lat = (3 * *lat + ms + 2) >> 2;
+}
+
+#ifdef DFU_VERIFY
+static void
+_dfu_verify_data(const uint8_t *data, unsigned len)
+{
+	g_dfu.vfy.res.crc_data = crc32(g_dfu.vfy.res.crc_data, data, len);
+}
+
+static void
+_dfu_verify_start(uint32_t addr, uint32_t end)
+{
+	/* Ranges add up, composite images are checked segment by segment */
+	if (g_dfu.vfy.res.state == DFU_VERIFY_FAIL)
+		return;
+
+	g_dfu.vfy.res.len  += end - addr;
+	g_dfu.vfy.res.state = DFU_VERIFY_RUNNING;
+	g_dfu.vfy.addr      = addr;
+	g_dfu.vfy.end       = end;
+	g_dfu.vfy.sel       = g_dfu.flash.selected;
+	g_dfu.vfy.crc       = g_dfu.vfy.res.crc_data;
+	g_dfu.vfy.t0        = usb_get_tick();
+	g_dfu.vfy.len       = end - addr;
+}
+
+static void
+_dfu_verify_step(void)
+{
+	/* Read back 1k per call. Own small buffer since the next
+	 * composite segment may already sit in the program one */
+	uint32_t chunk[16];
+	uint32_t end = g_dfu.vfy.end;
+
+	for (int i=0; (i<1024) && (g_dfu.vfy.addr < end); i+=sizeof(chunk)) {
+		unsigned len = end - g_dfu.vfy.addr;
+		if (len > sizeof(chunk))
+			len = sizeof(chunk);
+
+		flash_quad_io_read(chunk, g_dfu.vfy.addr, len);
+		g_dfu.vfy.res.crc_flash = crc32(g_dfu.vfy.res.crc_flash, chunk, len);
+		g_dfu.vfy.addr += len;
+	}
+
+	if (g_dfu.vfy.addr == end) {
+		DBG_PRINTF("Verify %08x / %08x - t=%d\n", g_dfu.vfy.crc, g_dfu.vfy.res.crc_flash, usb_get_tick());
+		g_dfu.vfy.res.state = (g_dfu.vfy.res.crc_flash == g_dfu.vfy.crc) ?
+			DFU_VERIFY_OK : DFU_VERIFY_FAIL;
+
+		if (g_dfu.vfy.len >= 65536) {
+			uint32_t ms = usb_get_tick() - g_dfu.vfy.t0;
+			_dfu_lat_update(&g_dfu.lat.vfy, (ms << 16) / g_dfu.vfy.len);
+		}
+	}
+}
+#endif
+
+#ifdef DFU_COMPRESSED
+static unsigned
+_dfu_ring_avail(void)
+{
+	return (g_dfu.ring.used << 12) - (g_dfu.ring.rd & 4095);
+}
+
+static unsigned
+_dfu_ring_read(uint8_t *data, unsigned len)
+{
+	/* Byte granular read, up to the end of the PSRAM page */
+	uint32_t ofs = g_dfu.ring.rd;
+	unsigned pl = DFU_PSRAM_PAGE - (ofs & (DFU_PSRAM_PAGE - 1));
+
+	if (len > pl)
+		len = pl;
+
+	psram_read(ofs / DFU_PSRAM_SIZE, data, ofs & (DFU_PSRAM_SIZE - 1), len);
+
+	g_dfu.ring.rd = (ofs + len) & (2 * DFU_PSRAM_SIZE - 1);
+	if (!(g_dfu.ring.rd & 4095))
+		g_dfu.ring.used--;
+
+	return len;
+}
+
+static bool
+_dfu_lz_refill(struct lzd_src *src)
+{
+	/* Never read past what was asked for, so nothing is left
+	 * buffered here in between blocks */
+	unsigned n = _dfu_ring_avail();
+
+	if (n > g_dfu.lz.want)
+		n = g_dfu.lz.want;
+	if (n > sizeof(g_dfu.lz.chunk))
+		n = sizeof(g_dfu.lz.chunk);
+	if (!n)
+		return false;
+
+	n = _dfu_ring_read(g_dfu.lz.chunk, n);
+	g_dfu.lz.want -= n;
+
+	src->p = g_dfu.lz.chunk;
+	src->e = g_dfu.lz.chunk + n;
+
+	return true;
+}
+
+static bool
+_dfu_lz_start(const uint8_t *data, unsigned len)
+{
+	uint32_t hdr[2];
+
+	/* Compressed streams start with a header */
+	if (len < LZD_HDR_LEN)
+		return true;
+
+	memcpy(hdr, data, LZD_HDR_LEN);
+
+	if (hdr[0] != LZD_MAGIC)
+		return true;
+
+	/* Composite segments are checked when parsed */
+#ifdef DFU_COMPOSITE
+	if (!g_dfu.comp.active)
+#endif
+	if (hdr[1] > (g_dfu.flash.addr_end - g_dfu.flash.addr_prog))
+		return false;
+
+	g_dfu.lz.active = true;
+	g_dfu.lz.end    = g_dfu.flash.addr_prog + hdr[1];
+	g_dfu.lz.left   = hdr[1];
+	g_dfu.lz.src.refill = _dfu_lz_refill;
+
+	/* Skip it, it's at the start of the first ring block */
+	g_dfu.ring.rd += LZD_HDR_LEN;
+
+	return true;
+}
+
+static bool
+_dfu_lz_pop(uint8_t *data)
+{
+	unsigned len;
+
+	/* End of stream, drop the padding of the last download block */
+	if (!g_dfu.lz.left) {
+		g_dfu.ring.rd   = g_dfu.ring.wr;
+		g_dfu.ring.used = 0;
+		return false;
+	}
+
+	/* Block length */
+	if (!g_dfu.lz.clen) {
+		if (_dfu_ring_avail() < 2)
+			goto wait;
+
+		for (int i=0; i<2; i+=_dfu_ring_read(&g_dfu.lz.chunk[i], 2-i));
+		g_dfu.lz.clen = g_dfu.lz.chunk[0] | (g_dfu.lz.chunk[1] << 8);
+	}
+
+	/* Only decode once the whole block is in */
+	if (_dfu_ring_avail() < g_dfu.lz.clen)
+		goto wait;
+
+	len = (g_dfu.lz.left < LZD_BLK_LEN) ? g_dfu.lz.left : LZD_BLK_LEN;
+
+	g_dfu.lz.want = g_dfu.lz.clen;
+
+	if (!lzd_decode(&g_dfu.lz.src, data, len) || g_dfu.lz.want || (g_dfu.lz.src.p != g_dfu.lz.src.e))
+		goto error;
+
+	if (len < 4096)
+		memset(&data[len], 0xff, 4096 - len);
+
+#ifdef DFU_VERIFY
+#ifdef DFU_COMPOSITE
+	if (!g_dfu.comp.active)
+#endif
+		_dfu_verify_data(data, len);
+#endif
+
+	g_dfu.lz.left -= len;
+	g_dfu.lz.clen  = 0;
+
+	return true;
+
+wait:
+	/* Host said it was done, stream is truncated */
+	if (!g_dfu.flash.recv_done)
+		return false;
+
+error:
+	_dfu_fail(errFILE);
+	return false;
+}
+#endif
+
+#ifdef DFU_COMPOSITE
+static bool
+_dfu_comp_hdr_check(const uint8_t *data, struct dfu_comp_hdr *hdr)
+{
+	uint32_t zs, ze;
+
+	memcpy(hdr, data, sizeof(*hdr));
+
+	if ((hdr->magic != DFU_COMP_MAGIC) || (hdr->zone >= DFU_ALT_COMPOSITE) || (hdr->offset & 4095))
+		return false;
+
+	zs = dfu_zones[hdr->zone].start;
+	ze = dfu_zones[hdr->zone].end;
+
+	return (hdr->offset <= (ze - zs)) && (hdr->len <= (ze - zs - hdr->offset));
+}
+
+static bool
+_dfu_comp_seg_start(const uint8_t *data)
+{
+	struct dfu_comp_hdr hdr;
+	uint32_t zs;
+
+	if (!_dfu_comp_hdr_check(data, &hdr))
+		return false;
+
+	zs = dfu_zones[hdr.zone].start;
+
+	DBG_PRINTF("Segment zone %d @ %08x, %d bytes - t=%d\n", hdr.zone, zs + hdr.offset, hdr.len, usb_get_tick());
+
+	/* Point the flash state at it, addr_end bounds the erases */
+	g_dfu.flash.selected   = dfu_zones[hdr.zone].flashsel;
+	g_dfu.flash.addr_prog  = zs + hdr.offset;
+	g_dfu.flash.addr_erase = zs + hdr.offset;
+	g_dfu.flash.addr_end   = (zs + hdr.offset + hdr.len + 4095) & ~4095;
+	g_dfu.flash.erase_len  = 0;
+
+	g_dfu.comp.start = zs + hdr.offset;
+	g_dfu.comp.end   = zs + hdr.offset + hdr.len;
+	g_dfu.comp.left  = hdr.len;
+
+#ifdef DFU_CHIP_OVERLAP
+	/* Pick up what was erased ahead on this chip */
+	if ((g_dfu.xe.sel == g_dfu.flash.selected) && (g_dfu.xe.start == g_dfu.comp.start) && g_dfu.xe.end)
+		g_dfu.flash.addr_erase = g_dfu.xe.addr;
+
+	/* Wait for its last erase like for our own */
+	if (g_dfu.xe.busy && (g_dfu.xe.sel == g_dfu.flash.selected)) {
+		flashchip_select(g_dfu.flash.selected);
+		flash_wait_start(DFU_POLL_ERASE_CYCLES);
+		g_dfu.flash.erase_t0    = g_dfu.xe.t0;
+		g_dfu.flash.erase_ms    = g_dfu.xe.ms;
+		g_dfu.flash.susp_t      = usb_get_tick();
+		g_dfu.flash.erasing     = true;
+		g_dfu.flash.erase_timed = false;
+		g_dfu.xe.busy = false;
+	}
+
+	/* Next header sits right after the padded data, unless the
+	 * stream is compressed */
+	g_dfu.xe.addr = g_dfu.xe.end = 0;
+	g_dfu.xe.peek = ~0;
+#ifdef DFU_COMPRESSED
+	if (!g_dfu.lz.active)
+#endif
+		g_dfu.xe.peek = (g_dfu.ring.rd + ((hdr.len + 4095) & ~4095)) & (2 * DFU_PSRAM_SIZE - 1);
+#endif
+
+	return true;
+}
+#endif
+
+static void
+_dfu_buf_release(void)
+{
+#ifndef DFU_PSRAM_STAGING
+	g_dfu.buf.rd ^= 1;
+#endif
+	g_dfu.buf.used--;
+}
+
+static bool
+_dfu_buf_full(void)
+{
+#ifdef DFU_PSRAM_STAGING
+	/* Room for a full transfer ? */
+	return g_dfu.ring.used > (DFU_RING_BLOCKS - (DFU_XFER_MAX / 4096));
+#else
+	return g_dfu.buf.used == 2;
+#endif
+}
+
+static unsigned
+_dfu_buf_pending(void)
+{
+#ifdef DFU_PSRAM_STAGING
+	return g_dfu.ring.used + g_dfu.buf.used;
+#else
+	return g_dfu.buf.used;
+#endif
+}
+
+static unsigned
+_dfu_buf_excess(void)
+{
+	/* Blocks to write before there's room for a transfer, if full */
+#ifdef DFU_PSRAM_STAGING
+	return _dfu_buf_pending() - (DFU_RING_BLOCKS - (DFU_XFER_MAX / 4096));
+#else
+	return 1;
+#endif
+}
+
+static bool
+_dfu_busy(void)
+{
+	/* Data still to write or to verify */
+#ifdef DFU_VERIFY
+	if (g_dfu.vfy.res.state == DFU_VERIFY_RUNNING)
+		return true;
+	if (g_dfu.flash.recv_done && (g_dfu.vfy.res.state == DFU_VERIFY_NONE)
+#ifdef DFU_COMPOSITE
+	    && !g_dfu.comp.active
+#endif
+	)
+		return true;
+#endif
+	return _dfu_buf_pending() != 0;
+}
+
+static bool
+_dfu_is_blank(const void *data, unsigned len)
+{
+	const uint32_t *p = data;
+	uint32_t v = 0xffffffff;
+
+	for (len>>=2; len; len--)
+		v &= *p++;
+
+	return v == 0xffffffff;
+}
+
+#if defined(DFU_BLANK_CHECK) || defined(DFU_DELTA_UPDATE)
+static bool
+_dfu_flash_check(uint32_t addr, const uint8_t *ref, unsigned len)
+{
+	uint32_t chunk[16];
+
+	/* Compare against 'ref' or against blank if NULL. Small chunks so
+	 * we bail out early on the first difference */
+	for (; len; addr+=sizeof(chunk), len-=sizeof(chunk)) {
+		flash_quad_io_read(chunk, addr, sizeof(chunk));
+		if (ref) {
+			if (memcmp(chunk, ref, sizeof(chunk)))
+				return false;
+			ref += sizeof(chunk);
+		} else {
+			if (!_dfu_is_blank(chunk, sizeof(chunk)))
+				return false;
+		}
+	}
+
+	return true;
+}
+#endif
+
+static unsigned
+_dfu_erase_cost_32k(uint32_t addr, uint32_t end)
+{
+	/* Cheapest of a 32k erase or 4k ones for the sectors needed in it,
+	 * from the erase times measured on this flash */
+	unsigned n;
+
+	if (addr >= end)
+		return 0;
+
+	n = (((end - addr) > 32768) ? 32768 : (end - addr)) >> 12;
+
+	return (n * g_dfu.lat.erase[0]) < g_dfu.lat.erase[1] ? (n * g_dfu.lat.erase[0]) : g_dfu.lat.erase[1];
+}
+
+static uint32_t
+_dfu_erase_plan(uint32_t addr, uint32_t end)
+{
+	/* Sizes are tried from the largest the address alignment allows.
+	 * Erasing past 'end' is fine, but never past addr_end : the zone
+	 * end, or the composite segment end */
+	if (!(addr & 0xffff) && ((addr + 65536) <= g_dfu.flash.addr_end)) {
+		if (g_dfu.lat.erase[2] <= (_dfu_erase_cost_32k(addr, end) + _dfu_erase_cost_32k(addr + 32768, end)))
+			return 65536;
+	}
+
+	if (!(addr & 0x7fff) && ((addr + 32768) <= g_dfu.flash.addr_end)) {
+		if (_dfu_erase_cost_32k(addr, end) == g_dfu.lat.erase[1])
+			return 32768;
+	}
+
+	return 4096;
+}
+
+static uint32_t
+_dfu_session_start(void)
+{
+#ifdef DFU_RESUME
+	return dfu_zones[g_dfu.alt].start + g_dfu.flash.resume;
+#else
+	return dfu_zones[g_dfu.alt].start;
+#endif
+}
+
+static bool
+_dfu_recv_raw(void)
+{
+	/* Received data maps 1:1 to the selected zone */
+#ifdef DFU_COMPRESSED
+	if (g_dfu.lz.active)
+		return false;
+#endif
+#ifdef DFU_COMPOSITE
+	if (g_dfu.comp.active)
+		return false;
+#endif
+	return true;
+}
+
+static uint32_t
+_dfu_recv_end(void)
+{
+	/* Received length is the compressed one */
+#ifdef DFU_COMPRESSED
+	if (g_dfu.lz.active)
+		return g_dfu.lz.end;
+#endif
+	return g_dfu.flash.addr_recv;
+}
+
+static uint32_t
+_dfu_erase_end(void)
+{
+#ifdef DFU_COMPOSITE
+	/* Segment length is known from its header */
+	if (g_dfu.comp.active)
+		return g_dfu.flash.addr_end;
+#endif
+
+	/* Until the host signals the end, assume data goes up to the zone end */
+	if (!g_dfu.flash.recv_done)
+		return g_dfu.flash.addr_end;
+
+	return (_dfu_recv_end() + 4095) & ~4095;
+}
+
+static void
+_dfu_erase_start(uint32_t addr, uint32_t len)
+{
+	DBG_PRINTF("Erase start %dk @ %08x - t=%d\n", len >> 10, addr, usb_get_tick());
+
+	flash_write_enable();
+
+	switch (len) {
+	case 4096:
+		flash_sector_erase(addr);
+		g_dfu.flash.erase_idx = 0;
+		break;
+	case 32768:
+		flash_block_erase_32k(addr);
+		g_dfu.flash.erase_idx = 1;
+		break;
+	default:
+		flash_block_erase_64k(addr);
+		g_dfu.flash.erase_idx = 2;
+		break;
+	}
+
+	flash_wait_start(DFU_POLL_ERASE_CYCLES);
+
+	g_dfu.flash.erase_ms    = g_dfu.lat.erase[g_dfu.flash.erase_idx];
+	g_dfu.flash.erase_t0    = usb_get_tick();
+	g_dfu.flash.susp_t      = g_dfu.flash.erase_t0;
+	g_dfu.flash.erasing     = true;
+	g_dfu.flash.erase_timed = true;
+}
+
+static bool
+_dfu_flash_ready(void)
+{
+	if (!flash_wait_done())
+		return false;
+
+	/* Erase completion is only seen here */
+	if (g_dfu.flash.erase_timed) {
+		uint32_t ms = usb_get_tick() - g_dfu.flash.erase_t0;
+		_dfu_lat_update(&g_dfu.lat.erase[g_dfu.flash.erase_idx], ms);
+		g_dfu.flash.erase_timed = false;
+	}
+
+	return true;
+}
+
+static uint32_t
+_dfu_erase_time_left(void)
+{
+	uint32_t elapsed = usb_get_tick() - g_dfu.flash.erase_t0;
+	return (elapsed < g_dfu.flash.erase_ms) ? (g_dfu.flash.erase_ms - elapsed) : 0;
+}
+
+static uint32_t
+_dfu_backlog_ms(unsigned blocks)
+{
+	/* Time until 'blocks' more pending blocks are written : what's
+	 * left of the running erase, erases still needed, programming */
+	uint32_t end = g_dfu.flash.addr_prog + (blocks << 12);
+	uint32_t t = _dfu_erase_time_left();
+
+	if (end > g_dfu.flash.addr_erase) {
+		uint32_t n = end - g_dfu.flash.addr_erase;
+		uint32_t t4k = ((n & 0xffff) >> 12) * g_dfu.lat.erase[0];
+
+		t += (n >> 16) * g_dfu.lat.erase[2];
+		t += (t4k < g_dfu.lat.erase[2]) ? t4k : g_dfu.lat.erase[2];
+	}
+
+	return t + blocks * g_dfu.lat.prog;
+}
+
+static uint32_t
+_dfu_manifest_ms(void)
+{
+	/* Everything left : write what's pending, then read it back */
+	uint32_t t = _dfu_backlog_ms(_dfu_buf_pending());
+#ifdef DFU_VERIFY
+	uint32_t n = 0;
+
+	if (g_dfu.vfy.res.state == DFU_VERIFY_RUNNING)
+		n = g_dfu.vfy.end - g_dfu.vfy.addr;
+#ifdef DFU_COMPOSITE
+	if (g_dfu.comp.active)
+		n += _dfu_buf_pending() << 12;
+	else
+#endif
+	if (g_dfu.vfy.res.state == DFU_VERIFY_NONE)
+		n += _dfu_recv_end() - _dfu_session_start();
+
+	t += ((n >> 12) * g_dfu.lat.vfy) >> 4;
+#endif
+	return t;
+}
+
+static void
+_dfu_erase_next(uint32_t end)
+{
+	/* Plan next command, it's kept until issued or skipped */
+	if (!g_dfu.flash.erase_len)
+		g_dfu.flash.erase_len = _dfu_erase_plan(g_dfu.flash.addr_erase, end);
+
+#ifdef DFU_BLANK_CHECK
+	/* Check 4k of the block per call to keep EP0 responsive */
+	if (_dfu_flash_check(g_dfu.flash.addr_erase + g_dfu.flash.op_chk, NULL, 4096)) {
+		g_dfu.flash.op_chk += 4096;
+		if (g_dfu.flash.op_chk == g_dfu.flash.erase_len) {
+			/* Already erased, nothing to do */
+			DBG_PRINTF("Erase skip %dk @ %08x - t=%d\n", g_dfu.flash.erase_len >> 10, g_dfu.flash.addr_erase, usb_get_tick());
+			g_dfu.flash.addr_erase += g_dfu.flash.erase_len;
+			g_dfu.flash.erase_len = 0;
+			g_dfu.flash.op_chk = 0;
+		}
+		return;
+	}
+
+	g_dfu.flash.op_chk = 0;
+#endif
+
+	/* No, issue the next command */
+	_dfu_erase_start(g_dfu.flash.addr_erase, g_dfu.flash.erase_len);
+	g_dfu.flash.addr_erase += g_dfu.flash.erase_len;
+	g_dfu.flash.erase_len = 0;
+}
+
+#ifdef DFU_ERASE_AHEAD
+static void
+_dfu_erase_ahead(void)
+{
+	/* Everything below addr_erase is erased already, so while idle
+	 * extend that to 'ahead' bytes past the write pointer */
+	uint32_t end = _dfu_erase_end();
+
+	if (!g_dfu.flash.ahead || (g_dfu.state == dfuERROR))
+		return;
+
+	if ((end - g_dfu.flash.addr_prog) > g_dfu.flash.ahead)
+		end = g_dfu.flash.addr_prog + g_dfu.flash.ahead;
+
+	if (g_dfu.flash.addr_erase >= end)
+		return;
+
+	flashchip_select(g_dfu.flash.selected);
+	_dfu_erase_next(end);
+}
+
+static void
+_dfu_erase_ahead_arm(void)
+{
+	/* First DNLOAD of a session, the setting is used up. Never for
+	 * composite images, nor the bootloader, nor delta updates */
+	if (g_dfu.alt < DFU_ALT_COMPOSITE)
+		g_dfu.flash.ahead = g_dfu.ahead;
+#ifdef DFU_DELTA_UPDATE
+	if (g_dfu.flash.delta)
+		g_dfu.flash.ahead = 0;
+#endif
+	g_dfu.ahead = 0;
+}
+#endif
+
+#ifdef DFU_CHIP_OVERLAP
+static void
+_dfu_xe_peek(void)
+{
+	/* Is the next segment header in the ring yet ? */
+	struct dfu_comp_hdr hdr;
+	uint8_t data[sizeof(hdr)];
+	uint32_t start;
+
+	if (((g_dfu.xe.peek - g_dfu.ring.rd) & (2 * DFU_PSRAM_SIZE - 1)) >= (g_dfu.ring.used << 12))
+		return;
+
+	_dfu_ring_peek(g_dfu.xe.peek, data, sizeof(data));
+	g_dfu.xe.peek = ~0;
+
+	/* Only worth it on the other chip, bad ones fail when parsed */
+	if (!_dfu_comp_hdr_check(data, &hdr) || (dfu_zones[hdr.zone].flashsel == g_dfu.flash.selected))
+		return;
+
+	start = dfu_zones[hdr.zone].start + hdr.offset;
+
+	g_dfu.xe.sel   = dfu_zones[hdr.zone].flashsel;
+	g_dfu.xe.start = start;
+	g_dfu.xe.addr  = start;
+	g_dfu.xe.end   = (start + hdr.len + 4095) & ~4095;
+}
+
+static void
+_dfu_xe_step(void)
+{
+	/* One erase command on the other chip. The status poller only
+	 * watches the selected one, park it meanwhile */
+	bool busy = !flash_wait_done();
+	uint32_t addr = g_dfu.xe.addr;
+	uint32_t len;
+
+	if (g_dfu.xe.peek != ~0U)
+		_dfu_xe_peek();
+
+	if (addr >= g_dfu.xe.end)
+		return;
+
+#ifdef DFU_VERIFY
+	/* Previous segment may still be read back from there */
+	if ((g_dfu.vfy.res.state == DFU_VERIFY_RUNNING) && (g_dfu.vfy.sel == g_dfu.xe.sel))
+		return;
+#endif
+
+	/* No point reading SR1 before it should be done */
+	if (g_dfu.xe.busy && ((usb_get_tick() - g_dfu.xe.t0) < g_dfu.xe.ms))
+		return;
+
+	if (busy)
+		flash_wait_ack();
+
+	flashchip_select(g_dfu.xe.sel);
+
+	if (!(flash_read_sr() & 1)) {
+		len = (!(addr & 0xffff) && ((addr + 65536) <= g_dfu.xe.end)) ? 65536 : 4096;
+
+		DBG_PRINTF("Erase ahead %dk @ %08x on other chip - t=%d\n", len >> 10, addr, usb_get_tick());
+
+		flash_write_enable();
+		if (len == 65536)
+			flash_block_erase_64k(addr);
+		else
+			flash_sector_erase(addr);
+
+		g_dfu.xe.addr += len;
+		g_dfu.xe.t0    = usb_get_tick();
+		g_dfu.xe.ms    = g_dfu.lat.erase[(len == 65536) ? 2 : 0];
+		g_dfu.xe.busy  = true;
+	}
+
+	flashchip_select(g_dfu.flash.selected);
+
+	if (busy)
+		flash_wait_start(g_dfu.flash.erasing ? DFU_POLL_ERASE_CYCLES : DFU_POLL_PROG_CYCLES);
+}
+
+static void
+_dfu_xe_wait(void)
+{
+	if (!g_dfu.xe.busy)
+		return;
+
+	flash_wait_ack();
+	flashchip_select(g_dfu.xe.sel);
+	while (flash_read_sr() & 1);
+	g_dfu.xe.busy = false;
+}
+#endif
+
+static bool
+_dfu_flash_suspend(void)
+{
+#ifdef DFU_FLASH_SUSPEND
+	/* Programs are done in < 1 ms, only erases are worth it. And
+	 * they need to progress in between suspends */
+	if (!g_dfu.flash.erasing || flash_wait_done())
+		return false;
+
+	if ((usb_get_tick() - g_dfu.flash.susp_t) < DFU_SUSPEND_MIN_MS)
+		return false;
+
+	DBG_PRINTF("Erase suspend - t=%d\n", usb_get_tick());
+
+	flash_suspend();
+	g_dfu.flash.susp_t = usb_get_tick();
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void
+_dfu_flash_resume(void)
+{
+	uint32_t now = usb_get_tick();
+
+	flash_resume(DFU_POLL_ERASE_CYCLES);
+
+	/* Time spent suspended doesn't count */
+	g_dfu.flash.erase_t0 += now - g_dfu.flash.susp_t;
+	g_dfu.flash.susp_t = now;
+}
+
+static unsigned
+_dfu_upload_len(unsigned max)
+{
+	uint32_t left = g_dfu.flash.addr_end - g_dfu.up.addr;
+	return (left < max) ? left : max;
+}
+
+static void
+_dfu_upload_read(unsigned len)
+{
+	/* Read (more of) the next block in the idle buffer half */
+	if (g_dfu.up.pf_ofs >= len)
+		return;
+
+	flashchip_select(g_dfu.flash.selected);
+	flash_quad_io_read_async(
+		&g_dfu.buf.data[g_dfu.up.half][g_dfu.up.pf_ofs],
+		g_dfu.up.addr + g_dfu.up.pf_ofs,
+		len - g_dfu.up.pf_ofs
+	);
+	g_dfu.up.pf_ofs = len;
+}
+
+static void
+_dfu_upload_prefetch(void)
+{
+	/* Read ahead 1k per call while EP0 sends the other half */
+	unsigned len = _dfu_upload_len(4096);
+	unsigned ofs = g_dfu.up.pf_ofs + 1024;
+	bool susp = false;
+
+	flashchip_select(g_dfu.flash.selected);
+	if (!flash_wait_done() && !(susp = _dfu_flash_suspend()))
+		return;
+
+	_dfu_upload_read(ofs < len ? ofs : len);
+
+	if (susp)
+		_dfu_flash_resume();
+}
+
+#ifdef DFU_VERIFY
+static void
+_dfu_verify_tick(void)
+{
+	bool susp = false;
 
-		enum {
-			FL_IDLE = 0,
-			FL_ERASE,
-			FL_PROGRAM,
-		} op;
-	} flash;
-} g_dfu;
+	/* Flash busy ? Then the range has to be on the chip being
+	 * written, and we can only get in during an erase */
+	if (!flash_wait_done()) {
+		if (g_dfu.vfy.sel != g_dfu.flash.selected)
+			return;
 
-static const struct {
-	uint32_t flashsel;
-	uint32_t start;
-	uint32_t end;
-} dfu_zones[6] = {
-	{ FLASHCHIP_INTERNAL, 0x00180000, 0x00300000 },	/* ECP5 bitstream */
-	{ FLASHCHIP_INTERNAL, 0x00300000, 0x00380000 },	/* RISC-V firmware */
-	{ FLASHCHIP_CART,     0x00000000, 0x00180000 },	/* Cart ECP5 bitstream */
-	{ FLASHCHIP_CART,     0x00180000, 0x00200000 },	/* Cart IPL region */
-	{ FLASHCHIP_CART,     0x00200000, 0x01000000 },	/* Cart filesystem region */
-	{ FLASHCHIP_INTERNAL, 0x00000000, 0x00180000 },	/* Boot Loader */
-};
+		flashchip_select(g_dfu.flash.selected);
+		if (!(susp = _dfu_flash_suspend()))
+			return;
+	}
 
+	flashchip_select(g_dfu.vfy.sel);
+	_dfu_verify_step();
 
-//static void
-void
-_dfu_tick(void)
+	if (susp)
+		_dfu_flash_resume();
+}
+#endif
+
+static void
+_dfu_tick_step(void)
 {
 	/* Rate limit to once every 10 ms */
 #ifdef DFU_SOF_POLL_LIMIT
@@ -174,24 +1251,148 @@ _dfu_tick(void)
 	g_dfu.tick = 0;
 #endif
 
+	/* Uploads don't overlap with writes */
+	if (g_dfu.state == dfuUPLOAD_IDLE) {
+		_dfu_upload_prefetch();
+		return;
+	}
+
+#ifdef DFU_VERIFY
+	/* Read back what's fully written, alongside the rest */
+	if (g_dfu.vfy.res.state == DFU_VERIFY_RUNNING)
+		_dfu_verify_tick();
+#endif
+
 	/* Anything to do ? Is flash ready ? */
 	if (g_dfu.flash.op == FL_IDLE) {
+#ifdef DFU_PSRAM_STAGING
+		/* Refill the program buffer from the ring */
+		if (!g_dfu.buf.used && g_dfu.ring.used) {
+#ifdef DFU_COMPRESSED
+			if (g_dfu.lz.active) {
+				g_dfu.buf.used = _dfu_lz_pop(g_dfu.buf.data[g_dfu.buf.rd]);
+			} else
+#endif
+			{
+				_dfu_ring_pop(g_dfu.buf.data[g_dfu.buf.rd]);
+				g_dfu.buf.used = 1;
+			}
+		}
+#endif
 		if (g_dfu.buf.used) {
+#ifdef DFU_COMPOSITE
+			if (g_dfu.comp.active) {
+				uint8_t *data = g_dfu.buf.data[g_dfu.buf.rd];
+				unsigned len;
+
+				/* Segment header, nothing to write */
+				if (!g_dfu.comp.left) {
+					if (_dfu_comp_seg_start(data))
+						_dfu_buf_release();
+					else
+						_dfu_fail(errFILE);
+					return;
+				}
+
+				/* Segment data, the previous segment has to be
+				 * checked before this one ends */
+				len = (g_dfu.comp.left < 4096) ? g_dfu.comp.left : 4096;
+#ifdef DFU_VERIFY
+				if ((len == g_dfu.comp.left) && (g_dfu.vfy.res.state == DFU_VERIFY_RUNNING))
+					return;
+				_dfu_verify_data(data, len);
+#endif
+				g_dfu.comp.left -= len;
+			}
+#endif
 			/* Start a new operation */
 			g_dfu.flash.op = FL_ERASE;
 			g_dfu.flash.op_len = 4096;
 			g_dfu.flash.op_ofs = 0;
-		} else
+#ifdef DFU_DELTA_UPDATE
+			if (g_dfu.flash.delta)
+				g_dfu.flash.op = FL_COMPARE;
+#endif
+			if (g_dfu.flash.op == FL_ERASE)
+				g_dfu.stats.sect_written++;
+		} else {
+#ifdef DFU_COMPOSITE
+			/* Host ended in the middle of a segment */
+			if (g_dfu.comp.left && g_dfu.flash.recv_done)
+				_dfu_fail(errFILE);
+#endif
+#ifdef DFU_COMPRESSED
+			/* Host ended on a block boundary, short of the
+			 * declared length. Reported once */
+			if (g_dfu.lz.active && g_dfu.lz.left && g_dfu.flash.recv_done) {
+				g_dfu.lz.left = 0;
+				_dfu_fail(errFILE);
+			}
+#endif
+#ifdef DFU_VERIFY
+			/* All written, read it back. Composite segments are
+			 * done as they complete */
+			if (g_dfu.flash.recv_done && (g_dfu.vfy.res.state == DFU_VERIFY_NONE) &&
+#ifdef DFU_COMPOSITE
+			    !g_dfu.comp.active &&
+#endif
+			    !_dfu_buf_pending())
+				_dfu_verify_start(_dfu_session_start(), _dfu_recv_end());
+#endif
+#ifdef DFU_ERASE_AHEAD
+			/* Nothing to write, get ahead on erases */
+			if (_dfu_flash_ready())
+				_dfu_erase_ahead();
+#endif
+#ifdef DFU_CHIP_OVERLAP
+			if (g_dfu.comp.active)
+				_dfu_xe_step();
+#endif
 			return;
+		}
 	}
 
-	/* If flash is busy, we're stuck anyway */
-	else if (flash_read_sr() & 1)
+	/* If flash is busy, we're stuck anyway, but the other chip may
+	 * have work. Also in FL_IDLE, an erase ahead may be running */
+	if (!_dfu_flash_ready()) {
+#ifdef DFU_CHIP_OVERLAP
+		if (g_dfu.comp.active)
+			_dfu_xe_step();
+#endif
 		return;
+	}
 
 	/* Select flash chip to operate on. */
 	flashchip_select(g_dfu.flash.selected);
 
+#ifdef DFU_DELTA_UPDATE
+	/* Delta: Only rewrite the sector if it differs */
+	if (g_dfu.flash.op == FL_COMPARE) {
+		if (_dfu_flash_check(g_dfu.flash.addr_prog, g_dfu.buf.data[g_dfu.buf.rd], g_dfu.flash.op_len)) {
+			/* Identical, the program step will just complete */
+			DBG_PRINTF("Sector skip @ %08x - t=%d\n", g_dfu.flash.addr_prog, usb_get_tick());
+			g_dfu.stats.sect_skipped++;
+			g_dfu.flash.op_ofs = g_dfu.flash.op_len;
+			g_dfu.flash.op = FL_PROGRAM;
+		} else {
+			bool need_erase = true;
+
+			g_dfu.stats.sect_written++;
+			g_dfu.flash.op = FL_PROGRAM;
+
+#ifdef DFU_BLANK_CHECK
+			need_erase = !_dfu_flash_check(g_dfu.flash.addr_prog, NULL, g_dfu.flash.op_len);
+#endif
+
+			/* Erase that sector and wait for it */
+			if (need_erase) {
+				_dfu_erase_start(g_dfu.flash.addr_prog, 4096);
+				return;
+			}
+		}
+	}
+#endif
+
 	/* Erase */
 	if (g_dfu.flash.op == FL_ERASE) {
 		/* Done ? */
@@ -199,24 +1400,9 @@ _dfu_tick(void)
 			/* Yes, move to programming */
 			g_dfu.flash.op = FL_PROGRAM;
 			DBG_PRINTF("Erase done - t=%d\n", usb_get_tick());
-		} else{
-			/* No, issue the next command */
-#if 0
-			DBG_PRINTF("Erase start 4k @ %08x - t=%d\n", g_dfu.flash.addr_erase, usb_get_tick());
-			flash_write_enable();
-			flash_sector_erase(g_dfu.flash.addr_erase);
-			g_dfu.flash.addr_erase += 4096;
-#elif 0
-			DBG_PRINTF("Erase start 32k @ %08x - t=%d\n", g_dfu.flash.addr_erase, usb_get_tick());
-			flash_write_enable();
-			flash_block_erase_32k(g_dfu.flash.addr_erase);
-			g_dfu.flash.addr_erase += 32768;
-#else
-			DBG_PRINTF("Erase start 64k @ %08x - t=%d\n", g_dfu.flash.addr_erase, usb_get_tick());
-			flash_write_enable();
-			flash_block_erase_64k(g_dfu.flash.addr_erase);
-			g_dfu.flash.addr_erase += 65536;
-#endif
+		} else {
+			/* No, keep going */
+			_dfu_erase_next(_dfu_erase_end());
 		}
 	}
 
@@ -227,8 +1413,20 @@ _dfu_tick(void)
 			/* Yes ! */
 			g_dfu.flash.op = FL_IDLE;
 			g_dfu.flash.addr_prog += g_dfu.flash.op_len;
-			g_dfu.buf.rd ^= 1;
-			g_dfu.buf.used--;
+			_dfu_buf_release();
+
+			/* Block program time, scaled to a full block (skip
+			 * mostly blank ones, ms resolution is too coarse) */
+			if (g_dfu.flash.prog_n >= 4) {
+				uint32_t ms = usb_get_tick() - g_dfu.flash.prog_t0;
+				_dfu_lat_update(&g_dfu.lat.prog, (ms << 4) / g_dfu.flash.prog_n);
+				g_dfu.flash.prog_n = 0;
+			}
+#if defined(DFU_COMPOSITE) && defined(DFU_VERIFY)
+			/* End of segment, read it back */
+			if (g_dfu.comp.active && !g_dfu.comp.left)
+				_dfu_verify_start(g_dfu.comp.start, g_dfu.comp.end);
+#endif
 		} else {
 			/* Max len */
 			unsigned l = g_dfu.flash.op_len - g_dfu.flash.op_ofs;
@@ -236,10 +1434,22 @@ _dfu_tick(void)
 			if (l > pl)
 				l = pl;
 
-			/* Write page */
-			DBG_PRINTF("Page program start @ %08x - t=%d\n", g_dfu.flash.addr_prog + g_dfu.flash.op_ofs, usb_get_tick());
-			flash_write_enable();
-			flash_quad_page_program(&g_dfu.buf.data[g_dfu.buf.rd][g_dfu.flash.op_ofs], g_dfu.flash.addr_prog + g_dfu.flash.op_ofs, l);
+			/* Write page (unless all 0xff, erase already did that) */
+			uint8_t *data = &g_dfu.buf.data[g_dfu.buf.rd][g_dfu.flash.op_ofs];
+
+			if (!g_dfu.flash.op_ofs) {
+				g_dfu.flash.prog_t0 = usb_get_tick();
+				g_dfu.flash.prog_n  = 0;
+			}
+
+			if (!_dfu_is_blank(data, l)) {
+				g_dfu.flash.prog_n++;
+				DBG_PRINTF("Page program start @ %08x - t=%d\n", g_dfu.flash.addr_prog + g_dfu.flash.op_ofs, usb_get_tick());
+				flash_write_enable();
+				flash_quad_page_program_async(data, g_dfu.flash.addr_prog + g_dfu.flash.op_ofs, l);
+				flash_wait_start(DFU_POLL_PROG_CYCLES);
+				g_dfu.flash.erasing = false;
+			}
 
 			/* Next page */
 			g_dfu.flash.op_ofs += l;
@@ -247,36 +1457,215 @@ _dfu_tick(void)
 	}
 }
 
+#ifdef USE_IRQ
+static void
+_dfu_tick_sched(void)
+{
+	/* Without flash work, SOF / EP0 IRQs are enough. With some, the
+	 * flash ready IRQ brings us back, or retry a bit later */
+	if (!_dfu_busy() && (g_dfu.flash.op == FL_IDLE))
+		return;
+
+	if (flash_wait_done())
+		irq_timer(DFU_IRQ_POLL_CYCLES);
+}
+#endif
+
+//static void
+void
+_dfu_tick(void)
+{
+	_dfu_tick_step();
+#ifdef USE_IRQ
+	_dfu_tick_sched();
+#endif
+}
+
+static void
+_dfu_upload_reset(void)
+{
+	/* Next UPLOAD starts over from the zone start */
+	g_dfu.up.addr   = dfu_zones[g_dfu.alt].start;
+	g_dfu.up.pf_ofs = 0;
+}
+
+static void
+_dfu_session_reset(void)
+{
+	g_dfu.flash.addr_recv  = _dfu_session_start();
+	g_dfu.flash.addr_prog  = _dfu_session_start();
+	g_dfu.flash.addr_erase = _dfu_session_start();
+	g_dfu.flash.addr_end   = dfu_zones[g_dfu.alt].end;
+	g_dfu.flash.selected   = dfu_zones[g_dfu.alt].flashsel;
+	g_dfu.flash.recv_done  = false;
+	g_dfu.flash.erase_len  = 0;
+	g_dfu.flash.ahead      = 0;
+
+	_dfu_upload_reset();
+
+#ifdef DFU_PSRAM_STAGING
+	_dfu_ring_reset();
+#endif
+#ifdef DFU_COMPRESSED
+	memset(&g_dfu.lz, 0x00, sizeof(g_dfu.lz));
+#endif
+#ifdef DFU_COMPOSITE
+	memset(&g_dfu.comp, 0x00, sizeof(g_dfu.comp));
+	g_dfu.comp.active = (g_dfu.alt == DFU_ALT_COMPOSITE);
+#endif
+#ifdef DFU_CHIP_OVERLAP
+	/* A running erase stays tracked, new segments wait for it */
+	g_dfu.xe.peek = ~0;
+	g_dfu.xe.addr = g_dfu.xe.end = 0;
+#endif
+
+	memset(&g_dfu.stats, 0x00, sizeof(g_dfu.stats));
+#ifdef DFU_VERIFY
+	memset(&g_dfu.vfy, 0x00, sizeof(g_dfu.vfy));
+#endif
+}
+
+static void
+_dfu_drain(void)
+{
+	/* Finish pending flash work, before reboot. Only a download the
+	 * host ended gets written, any other is cut where it is */
+	if (!g_dfu.flash.recv_done)
+		_dfu_recv_abort();
+
+	while (_dfu_busy() || (g_dfu.flash.op != FL_IDLE))
+		_dfu_tick();
+
+	flashchip_select(g_dfu.flash.selected);
+	while (!flash_wait_done());
+
+#ifdef DFU_CHIP_OVERLAP
+	_dfu_xe_wait();
+	flashchip_select(g_dfu.flash.selected);
+#endif
+}
+
 static void
 _dfu_bus_reset(void)
 {
-	if (g_dfu.state != appDETACH)
+	if (g_dfu.state != appDETACH) {
+		_dfu_drain();
 		usb_dfu_cb_reboot();
+	}
 }
 
 static void
 _dfu_state_chg(enum usb_dev_state state)
 {
-	if (state == USB_DS_CONFIGURED)
+	if (state == USB_DS_CONFIGURED) {
 		g_dfu.state = dfuIDLE;
+		_dfu_upload_reset();
+	}
 }
 
 static bool
 _dfu_detach_done_cb(struct usb_xfer *xfer)
 {
+	_dfu_drain();
 	usb_dfu_cb_reboot();
 	return true;
 }
 
-static bool
-_dfu_dnload_done_cb(struct usb_xfer *xfer)
+static void
+_dfu_dnload_block(uint8_t *data, unsigned len)
 {
+	/* Failed while this was being received, drop it */
+	if (g_dfu.state == dfuERROR)
+		return;
+
+	/* Fill end of buffer with 0xff if not fully used */
+	if (len < 4096)
+		memset(&data[len], 0xff, 4096 - len);
+
+#ifdef DFU_COMPRESSED
+	/* First block tells us if the stream is compressed */
+	if ((g_dfu.flash.addr_recv == dfu_zones[g_dfu.alt].start) && !_dfu_lz_start(data, len)) {
+		g_dfu.state  = dfuERROR;
+		g_dfu.status = errADDRESS;
+		return;
+	}
+#endif
+
+	g_dfu.flash.addr_recv += len;
+
+#ifdef DFU_VERIFY
+	/* Compressed data is accounted for once decoded, composite
+	 * images segment by segment */
+	if (_dfu_recv_raw())
+		_dfu_verify_data(data, len);
+#endif
+
+#ifdef DFU_PSRAM_STAGING
+	/* Move to the ring right away, receive buffer is free again */
+	_dfu_ring_push(data);
+#else
 	/* Next buffer */
 	g_dfu.buf.wr ^= 1;
 	g_dfu.buf.used++;
+#endif
+}
+
+#ifdef DFU_PSRAM_STAGING
+static bool
+_dfu_dnload_data_cb(struct usb_xfer *xfer)
+{
+	/* Large transfers go to the ring 4k at a time */
+	_dfu_dnload_block(xfer->data, xfer->ofs);
+	xfer->ofs = 0;
+	return true;
+}
+#endif
+
+static bool
+_dfu_dnload_done_cb(struct usb_xfer *xfer)
+{
+	/* Whatever the data call back didn't take yet */
+	if (xfer->ofs)
+		_dfu_dnload_block(xfer->data, xfer->ofs);
 
 	/* State update */
-	g_dfu.state = dfuDNLOAD_SYNC;
+	if (g_dfu.state != dfuERROR)
+		g_dfu.state = dfuDNLOAD_SYNC;
+
+	return true;
+}
+
+static bool
+_dfu_upload_data_cb(struct usb_xfer *xfer)
+{
+	/* Complete the read ahead if needed and send that half */
+	unsigned len = (g_dfu.up.left < 4096) ? g_dfu.up.left : 4096;
+	bool paused;
+
+	paused = usb_dfu_flash_pause();
+	_dfu_upload_read(len);
+	spi_wait_idle();
+	if (paused)
+		_dfu_flash_resume();
+
+	xfer->data = g_dfu.buf.data[g_dfu.up.half];
+	xfer->len  = len;
+	xfer->ofs  = 0;
+
+	/* Next block read ahead goes in the other half */
+	g_dfu.up.addr  += len;
+	g_dfu.up.left  -= len;
+	g_dfu.up.pf_ofs = 0;
+	g_dfu.up.half  ^= 1;
+
+	return true;
+}
+
+static bool
+_dfu_upload_done_cb(struct usb_xfer *xfer)
+{
+	/* Short frame sent, back in dfuIDLE */
+	_dfu_upload_reset();
 
 	return true;
 }
@@ -284,6 +1673,8 @@ _dfu_dnload_done_cb(struct usb_xfer *xfer)
 static enum usb_fnd_resp
 _dfu_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 {
+	uint32_t poll_ms;
+	unsigned len;
 	uint8_t state;
 
 	/* If this a class or vendor request for DFU interface ? */
@@ -318,66 +1709,124 @@ _dfu_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		break;
 
 	case USB_RT_DFU_DNLOAD:
+		/* Session ended (done or aborted), SET_INTERFACE starts a
+		 * new one */
+		if (g_dfu.flash.recv_done)
+			goto error;
+
 		/* Check for last block */
 		if (req->wLength) {
-			/* Check length doesn't overflow */
-			g_dfu.flash.addr_recv += req->wLength;
+			if (req->wLength > DFU_XFER_MAX)
+				goto error;
+
+#ifdef DFU_ERASE_AHEAD
+			/* Erases only start once there's data coming */
+			if (g_dfu.state == dfuIDLE)
+				_dfu_erase_ahead_arm();
+#endif
 
-			if (g_dfu.flash.addr_recv > g_dfu.flash.addr_end)
+			/* Check length doesn't overflow. Otherwise it's
+			 * checked once decoded / parsed */
+			if (_dfu_recv_raw() && (req->wLength > (g_dfu.flash.addr_end - g_dfu.flash.addr_recv)))
 				goto error;
 
 			/* Setup buffer for data */
-			xfer->len     = req->wLength;
+			xfer->len     = 4096;
 			xfer->data    = g_dfu.buf.data[g_dfu.buf.wr];
 			xfer->cb_done = _dfu_dnload_done_cb;
-
-			/* Fill end of buffer with 0xff if not fully used */
-			if (xfer->len < 4096) {
-				memset(&xfer->data[xfer->len], 0xff, 4096 - xfer->len);
-			}
+#ifdef DFU_PSRAM_STAGING
+			xfer->cb_data = _dfu_dnload_data_cb;
+#endif
 		} else {
 			/* Last xfer */
 			g_dfu.state = dfuMANIFEST_SYNC;
+			g_dfu.flash.recv_done = true;
 		}
 		break;
 
 	case USB_RT_DFU_UPLOAD:
-		/* Not supported */
-		goto error;
+		/* Can't read while a download is still being written */
+		if (_dfu_buf_pending() || (g_dfu.flash.op != FL_IDLE))
+			goto error;
+
+#ifdef DFU_COMPOSITE
+		/* Nothing to read back as a whole */
+		if (g_dfu.comp.active)
+			goto error;
+#endif
+
+		/* Host wants to read, not write */
+		g_dfu.flash.ahead = 0;
+#ifdef DFU_ERASE_AHEAD
+		g_dfu.ahead = 0;
+#endif
+
+		/* Sent 4k at a time, alternating buffer halves */
+		len = _dfu_upload_len(req->wLength);
+		g_dfu.up.left = len;
+		_dfu_upload_data_cb(xfer);
+		xfer->cb_data = _dfu_upload_data_cb;
+
+		/* Short frame ends the upload, cursor rewinds once it's out */
+		if (len < req->wLength) {
+			g_dfu.state = dfuIDLE;
+			xfer->cb_done = _dfu_upload_done_cb;
+		} else {
+			g_dfu.state = dfuUPLOAD_IDLE;
+		}
+		break;
 
 	case USB_RT_DFU_GETSTATUS:
+		/* Nothing to wait for unless busy */
+		poll_ms = 0;
+
 		/* Update state */
 		if (g_dfu.state == dfuDNLOAD_SYNC) {
-			if (g_dfu.buf.used < 2) {
+			if (!_dfu_buf_full()) {
 				g_dfu.state = state = dfuDNLOAD_IDLE;
 			} else {
+				/* Host can sleep until there's room again */
 				state = dfuDNBUSY;
+				poll_ms = _dfu_backlog_ms(_dfu_buf_excess());
 			}
 		} else if (g_dfu.state == dfuMANIFEST_SYNC) {
+			/* Never wait for the flash here, the tick finishes
+			 * in the background. dfu-util takes the first dfuIDLE
+			 * as final, so only report it once everything is
+			 * written and verified, with a poll timeout covering
+			 * what's left until then */
+			if (_dfu_busy()) {
+				state = dfuMANIFEST;
+				poll_ms = _dfu_manifest_ms();
 #ifdef DFU_UTIL_SPEEDUP_WORDAROUND
-			/* dfu-util adds an unecessary 1s delay if you don't
-			 * respond with dfuIDLE directly instead of obeying the
-			 * poll timeout ... */
-			g_dfu.state = state = dfuIDLE;
-
-			while (g_dfu.buf.used)
-				_dfu_tick();
-#else
-			if (g_dfu.buf.used == 0) {
-				g_dfu.state = state = dfuIDLE;
+				/* dfu-util sleeps for the poll timeout after the
+				 * first status, then adds an unecessary 1s for
+				 * anything but dfuIDLE. Never show dfuMANIFEST, the
+				 * timeout covers the work so the next poll is final */
+				state = dfuMANIFEST_SYNC;
+#endif
+#ifdef DFU_VERIFY
+			} else if (g_dfu.vfy.res.state == DFU_VERIFY_FAIL) {
+				g_dfu.state  = state = dfuERROR;
+				g_dfu.status = errVERIFY;
+#endif
 			} else {
-				state = dfuMANIFEST;
+				g_dfu.state = state = dfuIDLE;
+				_dfu_upload_reset();
 			}
-#endif
 		} else {
 			state = g_dfu.state;
 		}
 
+		/* Still in a sync state means busy */
+		if ((state == dfuDNBUSY || g_dfu.state == dfuMANIFEST_SYNC) && (poll_ms < DFU_HOST_POLL_MS))
+			poll_ms = DFU_HOST_POLL_MS;
+
 		/* Return data */
 		xfer->data[0] = g_dfu.status;
-		xfer->data[1] = (DFU_HOST_POLL_MS >>  0) & 0xff;
-		xfer->data[2] = (DFU_HOST_POLL_MS >>  8) & 0xff;
-		xfer->data[3] = (DFU_HOST_POLL_MS >> 16) & 0xff;
+		xfer->data[1] = (poll_ms >>  0) & 0xff;
+		xfer->data[2] = (poll_ms >>  8) & 0xff;
+		xfer->data[3] = (poll_ms >> 16) & 0xff;
 		xfer->data[4] = state;
 		xfer->data[5] = 0;
 		break;
@@ -386,6 +1835,7 @@ _dfu_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		/* Clear error */
 		g_dfu.state = dfuIDLE;
 		g_dfu.status = OK;
+		_dfu_upload_reset();
 		break;
 
 	case USB_RT_DFU_GETSTATE:
@@ -394,8 +1844,15 @@ _dfu_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		break;
 
 	case USB_RT_DFU_ABORT:
-		/* Go to IDLE */
+		/* Go to IDLE, no more erases. Drop a download in progress */
+		if ((g_dfu.state == dfuDNLOAD_SYNC) || (g_dfu.state == dfuDNLOAD_IDLE))
+			_dfu_recv_abort();
 		g_dfu.state = dfuIDLE;
+		g_dfu.flash.ahead = 0;
+#ifdef DFU_ERASE_AHEAD
+		g_dfu.ahead = 0;
+#endif
+		_dfu_upload_reset();
 		break;
 
 	default:
@@ -418,15 +1875,27 @@ _dfu_set_intf(const struct usb_intf_desc *base, const struct usb_intf_desc *sel)
 	    (sel->bInterfaceProtocol != 0x02))
 		return USB_FND_CONTINUE;
 
+	/* Download cut short, drop what can't be written */
+	if (!g_dfu.flash.recv_done)
+		_dfu_recv_abort();
+
+	/* Previous manifest may still be running, don't wait for the
+	 * flash from a control request, the host can retry */
+	if (_dfu_busy() || (g_dfu.flash.op != FL_IDLE))
+		return USB_FND_ERROR;
+#ifdef DFU_CHIP_OVERLAP
+	if (g_dfu.xe.busy)
+		return USB_FND_ERROR;
+#endif
+
 	g_dfu.state = dfuIDLE;
 	g_dfu.intf  = sel->bInterfaceNumber;
 	g_dfu.alt   = sel->bAlternateSetting;
 
-	g_dfu.flash.addr_recv  = dfu_zones[g_dfu.alt].start;
-	g_dfu.flash.addr_prog  = dfu_zones[g_dfu.alt].start;
-	g_dfu.flash.addr_erase = dfu_zones[g_dfu.alt].start;
-	g_dfu.flash.addr_end   = dfu_zones[g_dfu.alt].end;
-	g_dfu.flash.selected   = dfu_zones[g_dfu.alt].flashsel;
+#ifdef DFU_RESUME
+	g_dfu.flash.resume = 0;
+#endif
+	_dfu_session_reset();
 
 	return USB_FND_SUCCESS;
 }
@@ -455,6 +1924,130 @@ static struct usb_fn_drv _dfu_drv = {
 };
 
 
+bool
+usb_dfu_set_delta(bool enable)
+{
+#ifdef DFU_DELTA_UPDATE
+	/* Only between downloads, this starts a new session */
+	if ((g_dfu.state != dfuIDLE) || _dfu_buf_pending() || (g_dfu.flash.op != FL_IDLE))
+		return false;
+
+	g_dfu.flash.delta = enable;
+	_dfu_session_reset();
+
+	return true;
+#else
+	return !enable;
+#endif
+}
+
+bool
+usb_dfu_set_resume(unsigned blocks)
+{
+#ifdef DFU_RESUME
+	/* Only between downloads on a plain zone, restarts the session
+	 * 'blocks' 4k blocks in. Host finds where from usb_dfu_block_crc() */
+	if ((g_dfu.state != dfuIDLE) || _dfu_buf_pending() || (g_dfu.flash.op != FL_IDLE))
+		return false;
+
+	if ((g_dfu.alt >= DFU_ALT_COMPOSITE) ||
+	    ((blocks << 12) > (dfu_zones[g_dfu.alt].end - dfu_zones[g_dfu.alt].start)))
+		return false;
+
+	g_dfu.flash.resume = blocks << 12;
+	_dfu_session_reset();
+
+	return true;
+#else
+	return !blocks;
+#endif
+}
+
+bool
+usb_dfu_block_crc(unsigned blk, uint32_t *crc, unsigned n)
+{
+#ifdef DFU_RESUME
+	/* CRC32 of 4k blocks of the zone, as currently in flash */
+	uint32_t chunk[16];
+	uint32_t addr = dfu_zones[g_dfu.alt].start + (blk << 12);
+	uint32_t end  = addr + (n << 12);
+
+	if ((g_dfu.state != dfuIDLE) || _dfu_busy() || (g_dfu.flash.op != FL_IDLE))
+		return false;
+
+	if ((g_dfu.alt >= DFU_ALT_COMPOSITE) || (end > dfu_zones[g_dfu.alt].end))
+		return false;
+
+	flashchip_select(g_dfu.flash.selected);
+
+	/* Erase ahead may still be running, no waiting in a control
+	 * request. Refused until it's done, host retries */
+	if (!flash_wait_done())
+		return false;
+
+	for (; addr<end; crc++) {
+		*crc = 0;
+		for (int i=0; i<4096; i+=sizeof(chunk), addr+=sizeof(chunk)) {
+			flash_quad_io_read(chunk, addr, sizeof(chunk));
+			*crc = crc32(*crc, chunk, sizeof(chunk));
+		}
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool
+usb_dfu_set_erase_ahead(unsigned blocks)
+{
+#ifdef DFU_ERASE_AHEAD
+	/* Applies to the next download only, 0xffff is the whole zone */
+	g_dfu.ahead = (blocks == 0xffff) ? 0xffffffff : (blocks << 16);
+	return true;
+#else
+	return !blocks;
+#endif
+}
+
+const struct usb_dfu_stats *
+usb_dfu_get_stats(void)
+{
+	return &g_dfu.stats;
+}
+
+bool
+usb_dfu_flash_pause(void)
+{
+	/* Waits for the flash to be usable, suspending a running erase
+	 * if possible. Returns true if usb_dfu_flash_resume() is needed */
+	flashchip_select(g_dfu.flash.selected);
+
+	while (!flash_wait_done())
+		if (_dfu_flash_suspend())
+			return true;
+
+	return false;
+}
+
+void
+usb_dfu_flash_resume(void)
+{
+	_dfu_flash_resume();
+}
+
+const struct usb_dfu_verify *
+usb_dfu_get_verify(void)
+{
+#ifdef DFU_VERIFY
+	return &g_dfu.vfy.res;
+#else
+	static const struct usb_dfu_verify none = { 0 };
+	return &none;
+#endif
+}
+
 void __attribute__((weak))
 usb_dfu_cb_reboot(void)
 {
@@ -468,5 +2061,28 @@ usb_dfu_init(void)
 
 	g_dfu.state = appDETACH;
 
+	g_dfu.lat.erase[0] = DFU_ERASE_4K_MS;
+	g_dfu.lat.erase[1] = DFU_ERASE_32K_MS;
+	g_dfu.lat.erase[2] = DFU_ERASE_64K_MS;
+	g_dfu.lat.prog     = DFU_PROG_4K_MS;
+	g_dfu.lat.vfy      = DFU_VERIFY_64K_MS;
+
+#ifdef DFU_ERASE_AHEAD
+	usb_dfu_set_erase_ahead(DFU_ERASE_AHEAD_DEFAULT);
+#endif
+
+#ifdef DFU_PSRAM_STAGING
+	g_dfu.buf.rd = 1;
+#endif
+
+#ifdef DFU_FLASH_QPI
+	/* Opcode / address in 2 clocks per byte. Chips that don't support
+	 * it stay in SPI mode, reboot_now() switches back */
+	flashchip_select(FLASHCHIP_CART);
+	flash_qpi_enter();
+	flashchip_select(FLASHCHIP_INTERNAL);
+	flash_qpi_enter();
+#endif
+
 	usb_register_function_driver(&_dfu_drv);
 }
@@ -23,5 +23,46 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Here since the descriptors' wTransferSize depends on it */
+#define DFU_PSRAM_STAGING
+
+#ifdef DFU_PSRAM_STAGING
+#define DFU_XFER_MAX	32768	/* wTransferSize, streamed to the ring */
+#else
+#define DFU_XFER_MAX	4096
+#endif
+
+struct usb_dfu_stats {
+	uint32_t sect_written;	/* 4k sectors erased and/or programmed */
+	uint32_t sect_skipped;	/* 4k sectors already holding the data (delta) */
+};
+
+enum usb_dfu_verify_state {
+	DFU_VERIFY_NONE = 0,
+	DFU_VERIFY_RUNNING,
+	DFU_VERIFY_OK,
+	DFU_VERIFY_FAIL,
+};
+
+struct usb_dfu_verify {
+	uint32_t len;		/* Bytes covered */
+	uint32_t crc_data;	/* CRC32 of the data received */
+	uint32_t crc_flash;	/* CRC32 read back from flash */
+	uint32_t state;		/* enum usb_dfu_verify_state */
+};
+
+bool usb_dfu_set_delta(bool enable);
+bool usb_dfu_set_erase_ahead(unsigned blocks);
+bool usb_dfu_set_resume(unsigned blocks);
+bool usb_dfu_block_crc(unsigned blk, uint32_t *crc, unsigned n);
+const struct usb_dfu_stats *usb_dfu_get_stats(void);
+const struct usb_dfu_verify *usb_dfu_get_verify(void);
+
+bool usb_dfu_flash_pause(void);
+void usb_dfu_flash_resume(void);
+
 void usb_dfu_cb_reboot(void);
 void usb_dfu_init(void);
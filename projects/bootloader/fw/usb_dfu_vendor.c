@@ -26,12 +26,19 @@
 #include <string.h>
 
 #include "usb.h"
+#include "usb_dfu.h"
 #include "spi.h"
 
 
 #define USB_RT_DFU_VENDOR_VERSION	((0 << 8) | 0xc1)
 #define USB_RT_DFU_VENDOR_SPI_EXEC	((1 << 8) | 0x41)
 #define USB_RT_DFU_VENDOR_SPI_RESULT	((2 << 8) | 0xc1)
+#define USB_RT_DFU_VENDOR_DELTA		((3 << 8) | 0x41)
+#define USB_RT_DFU_VENDOR_STATS		((4 << 8) | 0xc1)
+#define USB_RT_DFU_VENDOR_VERIFY	((5 << 8) | 0xc1)
+#define USB_RT_DFU_VENDOR_ERASE_AHEAD	((6 << 8) | 0x41)
+#define USB_RT_DFU_VENDOR_BLOCK_CRC	((7 << 8) | 0xc1)
+#define USB_RT_DFU_VENDOR_RESUME	((8 << 8) | 0x41)
 
 
 static bool
@@ -40,22 +47,35 @@ _dfu_vendor_spi_exec_cb(struct usb_xfer *xfer)
 	struct spi_xfer_chunk sx[1] = {
 		{ .data = xfer->data, .len = xfer->len, .read = true, .write = true, },
 	};
+	bool paused;
+
+	/* Don't collide with a DFU erase / program */
+	paused = usb_dfu_flash_pause();
 	spi_xfer(SPI_CS_FLASH, sx, 1);
+	if (paused)
+		usb_dfu_flash_resume();
+
 	return true;
 }
 
 enum usb_fnd_resp
 dfu_vendor_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 {
+	uint32_t crc[16];
+
 	switch (req->wRequestAndType)
 	{
 	case USB_RT_DFU_VENDOR_VERSION:
 		xfer->len  = 2;
-		xfer->data[0] = 0x01;
+		xfer->data[0] = 0x05;
 		xfer->data[1] = 0x00;
 		break;
 
 	case USB_RT_DFU_VENDOR_SPI_EXEC:
+		/* Raw commands are single bit, a flash in QPI would misread
+		 * them. Can't leave it around them, an erase may be suspended */
+		if (flash_qpi_active())
+			return USB_FND_ERROR;
 		xfer->cb_done = _dfu_vendor_spi_exec_cb;
 		break;
 
@@ -64,6 +84,47 @@ dfu_vendor_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		 * whatever the host requested ... */
 		break;
 
+	case USB_RT_DFU_VENDOR_DELTA:
+		/* wValue = 0 for full rewrite, 1 for delta */
+		if (!usb_dfu_set_delta(req->wValue != 0))
+			return USB_FND_ERROR;
+		break;
+
+	case USB_RT_DFU_VENDOR_ERASE_AHEAD:
+		/* wValue = 64k blocks to erase ahead of the data, 0 to disable.
+		 * For the next DNLOAD session only, an UPLOAD cancels it.
+		 * Unsafe if the host aborts, what's erased stays erased */
+		if (!usb_dfu_set_erase_ahead(req->wValue))
+			return USB_FND_ERROR;
+		break;
+
+	case USB_RT_DFU_VENDOR_BLOCK_CRC:
+		/* wValue = first 4k block of the zone, 4 bytes per block.
+		 * Host compares with its image to find where to resume.
+		 * STALLs while the flash is busy (erase ahead), retry */
+		if ((req->wLength & 3) || (req->wLength > sizeof(crc)) ||
+		    !usb_dfu_block_crc(req->wValue, crc, req->wLength >> 2))
+			return USB_FND_ERROR;
+		xfer->len = req->wLength;
+		memcpy(xfer->data, crc, xfer->len);
+		break;
+
+	case USB_RT_DFU_VENDOR_RESUME:
+		/* wValue = 4k block of the zone the next download starts at */
+		if (!usb_dfu_set_resume(req->wValue))
+			return USB_FND_ERROR;
+		break;
+
+	case USB_RT_DFU_VENDOR_STATS:
+		xfer->len = sizeof(struct usb_dfu_stats);
+		memcpy(xfer->data, usb_dfu_get_stats(), sizeof(struct usb_dfu_stats));
+		break;
+
+	case USB_RT_DFU_VENDOR_VERIFY:
+		xfer->len = sizeof(struct usb_dfu_verify);
+		memcpy(xfer->data, usb_dfu_get_verify(), sizeof(struct usb_dfu_verify));
+		break;
+
 	default:
 		return USB_FND_ERROR;
 	}
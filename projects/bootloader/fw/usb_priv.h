@@ -72,6 +72,7 @@ struct usb_stack {
 		} state;
 
 		uint8_t buf[64];
+		int left;		/* Data stage bytes left */
 
 		struct usb_xfer xfer;
 		struct usb_ctrl_req req;
@@ -24,5 +24,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 char *hexstr(void *d, int n, bool space);
+uint32_t crc32(uint32_t crc, const void *data, unsigned len);
@@ -35,28 +35,52 @@
 
 module qspi_master_wb #(
 	parameter integer N_CS = 1,
+	parameter integer FIFO_DEPTH = 16,
+	parameter integer DMA_AW = 13,
+	parameter integer FAST_SCK = 0		// Allow SCK = clk, PHYs must support it
 )(
 	// SPI PHY interface
 	input  wire [3:0] spi_io_i,
 	output reg  [3:0] spi_io_o,
 	output reg  [3:0] spi_io_t,
 
-	output wire spi_sck_o,
+	output wire [1:0] spi_sck_o,	// First / second half of the cycle
 	output wire [N_CS-1:0] spi_cs_o,
 
 	// Wishbone interface
-	input  wire [ 1:0] bus_addr,
+	input  wire [ 2:0] bus_addr,
 	input  wire [31:0] bus_wdata,
 	output reg  [31:0] bus_rdata,
 	input  wire bus_cyc,
 	output wire bus_ack,
 	input  wire bus_we,
 
+	// Memory read port (quad read on CS 0)
+	input  wire [23:0] mem_addr,
+	input  wire [15:0] mem_len,
+	input  wire mem_req,
+	output wire [ 7:0] mem_data,
+	output wire mem_stb,
+	output wire mem_done,
+
+	// DMA memory port (1 cycle read latency)
+	output wire [DMA_AW-1:0] dma_addr,
+	input  wire [31:0] dma_rdata,
+	output reg  [31:0] dma_wdata,
+	output reg  [ 3:0] dma_wmsk,
+	output reg  dma_we,
+
+	// IRQ
+	output wire irq,
+
 	// Clock
 	input  wire clk,
 	input  wire rst
 );
 
+	localparam integer FL = $clog2(FIFO_DEPTH);
+
+
 	// Signals
 	// -------
 
@@ -64,10 +88,16 @@ module qspi_master_wb #(
 	wire ack_nxt;
 	reg  ack;
 
+	wire bus_is_data;
+	wire bus_is_pdata;
+
 	wire rd_rst;
 
 	wire [31:0] rd_csr;
 
+	reg  irq_ena;
+	reg  flash_qpi;
+
 	// Bit-Bang state
 	reg  [N_CS-1:0] bb_cs;
 	reg        bb_clk;
@@ -94,6 +124,17 @@ module qspi_master_wb #(
 	reg  rxf_overflow_clr;
 	reg  rxf_overflow;
 
+	// Packed data
+	reg  [31:0] pk_wdata;
+	reg  [ 2:0] pk_wcnt;
+	wire pk_wbusy;
+	wire pk_wren;
+
+	reg  [31:0] pk_rdata;
+	reg  [ 2:0] pk_rcnt;
+	wire pk_rrdy;
+	wire pk_rden;
+
 	// Shift Registers
 	wire shift_out_ld_mode;
 	wire [7:0] shift_out_ld_data;
@@ -105,17 +146,93 @@ module qspi_master_wb #(
 	reg  [7:0] shift_out;
 	wire shift_out_ce;
 
-	reg  shift_in_mode;
+	wire shift_in_mode;
 	reg  [7:0] shift_in;
-	reg  shift_in_ce;
+	wire shift_in_ce;
+
+	wire shift_in_last;
 
-	reg  shift_in_last;
+	reg  [2:0] cap_ce;
+	reg  [2:0] cap_last;
+	reg  [2:0] cap_mode;
+	reg  [2:0] cap_fast;
 
 	// Commands
+	wire [9:0] cmd_do;
+	wire cmd_empty;
+	wire cmd_rden;
+
 	reg cmd_valid;
 	reg [1:0] cmd_cur;
 	reg [4:0] cmd_cnt;
 
+	wire fast;
+	wire bit_ce;
+	wire sck_lvl;
+
+	// Status poll
+	reg  poll_ena;
+	reg  poll_irq_ena;
+	reg  poll_ready;
+	reg  [N_CS-1:0] poll_cs;
+	reg  [15:0] poll_ival;
+	reg  [16:0] poll_cnt;
+	reg  [ 7:0] poll_sr;
+
+	wire poll_cfg_wr;
+	wire poll_start;
+	reg  poll_act;
+	reg  [1:0] poll_step;
+	wire poll_done;
+
+	// Sequencer
+	reg  [23:0] seq_addr;
+	reg  [15:0] seq_len;
+	reg  [ 7:0] seq_op;
+	reg  seq_rd;
+	reg  seq_q_cmd;
+	reg  seq_q_addr;
+	reg  seq_q_data;
+	reg  seq_fast;
+	reg  [N_CS-1:0] seq_cs;
+	reg  [ 1:0] seq_alen;
+	reg  [ 3:0] seq_dlen;
+
+	wire seq_cmd_wr;
+	reg  seq_req;
+	reg  seq_act;
+	reg  [ 2:0] seq_step;
+	reg  [ 2:0] seq_step_nxt;
+	reg  [15:0] seq_cnt;
+	reg  [15:0] seq_cnt_nxt;
+	reg  [FL:0] seq_rxc;
+	wire seq_end;
+
+	wire mem_start;
+	reg  seq_mem;
+
+	// DMA
+	reg  dma_ena;
+	reg  dma_act;
+	reg  dma_rd;
+	reg  [DMA_AW-1:0] dma_ptr;
+	reg  [15:0] dma_left;
+	reg  dma_fetch;
+	wire dma_fetch_start;
+	reg  [ 1:0] dma_idx;
+	wire dma_pop;
+
+	wire [9:0] seq_do;
+	wire seq_empty;
+	wire seq_rden;
+
+	localparam [2:0]
+		SEQ_OP    = 3'd0,
+		SEQ_ADDR  = 3'd1,
+		SEQ_DUMMY = 3'd2,
+		SEQ_DATA  = 3'd3,
+		SEQ_DONE  = 3'd4;
+
 
 
 	// [0] - Control / Status
@@ -123,8 +240,11 @@ module qspi_master_wb #(
 	//	[31] RX FIFO Empty
 	//  [30] RX FIFO Full
 	//  [29] RX FIFO Overflow
+	//  [28] IRQ enable (TX FIFO Empty & idle)
 	//  [27] TX FIFO Empty
 	//  [26] TX FIFO Full
+	//  [25] Status poll ready
+	//  [24] Flash in QPI mode (status poll and memory port commands)
 	//  [23:16] Chip-Select
 	//  [   12] Bit-Bang CLK force
 	//  [11: 8] Bit-Bang IO tristate
@@ -139,13 +259,72 @@ module qspi_master_wb #(
 	//                 01 - RW 1 bit
 	//                 10 - Write 4 bit
 	//                 11 - Read  4 bit
+	//
+	// [2] - Status poll
+	//       Issues READ_SR1 (0x05) every 'interval' clk while idle
+	//       until bit 0 (WIP) reads as 0, then sets 'ready' and stops.
+	//       Bus accesses are stalled while a poll is on the wire.
+	//
+	//  [31] Enable (writing 1 clears 'ready')
+	//  [30] IRQ on ready enable
+	//  [29] Ready (read only)
+	//  [23:16] Chip-Select to use (1 = selected)
+	//  [15: 0] Interval (Wr) / Last status read (Rd)
+	//
+	// [3] - Packed data
+	//       4 bytes, first one in [7:0]. Meant for the sequencer data
+	//       phase : written bytes are 'WO 1 bit' and reads stall until
+	//       4 bytes were received, so only read what's coming.
+	//
+	// [4] - Sequencer address
+	//  [23: 0] Address, sent MSB first
+	//
+	// [5] - Sequencer length
+	//  [15: 0] Data bytes
+	//
+	// [6] - Sequencer command
+	//       Writing runs a whole transaction : CS low, opcode, address,
+	//       dummy bytes (sent as 0x00), data, CS high. Write data is
+	//       taken from the TX FIFO, read data goes to the RX FIFO (never
+	//       more than it can hold, which must be empty to start). Data
+	//       register is for that only until done, and CS / bit-bang
+	//       must be left alone.
+	//
+	//  [31] Busy (Rd)
+	//  [30] Read data (else write)
+	//  [29] Opcode in 4 bit mode
+	//  [28] Address / dummy in 4 bit mode
+	//  [27] Data in 4 bit mode
+	//  [26:24] Chip-Select index
+	//  [23:22] Address bytes (0-3)
+	//  [   21] Fast clock : SCK = clk instead of clk / 2 (if FAST_SCK)
+	//  [19:16] Dummy bytes
+	//  [ 7: 0] Opcode
+	//
+	// [7] - DMA
+	//       When enabled, the next sequencer command takes its write
+	//       data from / puts its read data into memory instead of the
+	//       FIFOs, then disables it. Busy until the last byte is in
+	//       memory. FIFOs / data registers must be left alone meanwhile.
+	//
+	//  [31] Enable
+	//  [DMA_AW+1:2] Memory address (word aligned)
+	//
+	// The memory read port uses the sequencer too, while the SPI bus
+	// is idle and with all CS released. Bus accesses are stalled while
+	// it runs.
 
 
 	// Bus interface
 	// -------------
 
 	// Ack
-	assign ack_nxt = bus_cyc & ~ack & ~(bus_we & bus_addr[0] & txf_full);
+	assign bus_is_data  = (bus_addr == 3'b001);
+	assign bus_is_pdata = (bus_addr == 3'b011);
+	assign ack_nxt = bus_cyc & ~ack & ~(bus_we & bus_is_data & txf_full) &
+		~(bus_we & (bus_is_data | bus_is_pdata) & pk_wbusy) &
+		~(~bus_we & bus_is_pdata & ~pk_rrdy) &
+		~poll_act & ~(seq_act & seq_mem);
 
 	always @(posedge clk)
 		ack <= ack_nxt;
@@ -155,36 +334,77 @@ module qspi_master_wb #(
 	// CSR
 	always @(posedge clk)
 		if (rst) begin
-			bb_cs   <= { N_CS{1'b1} };
-			bb_clk  <= 1'b0;
-			bb_io_t <= 4'hf;
-			bb_io_o <= 4'h0;
-		end else if (ack & bus_we & ~bus_addr[0]) begin
-			bb_cs   <= bus_wdata[16+N_CS-1:16];
-			bb_clk  <= bus_wdata[12];
-			bb_io_t <= bus_wdata[11:8];
-			bb_io_o <= bus_wdata[7:4];
+			irq_ena   <= 1'b0;
+			flash_qpi <= 1'b0;
+			bb_cs     <= { N_CS{1'b1} };
+			bb_clk    <= 1'b0;
+			bb_io_t   <= 4'hf;
+			bb_io_o   <= 4'h0;
+		end else if (ack & bus_we & (bus_addr == 3'b000)) begin
+			irq_ena   <= bus_wdata[28];
+			flash_qpi <= bus_wdata[24];
+			bb_cs     <= bus_wdata[16+N_CS-1:16];
+			bb_clk    <= bus_wdata[12];
+			bb_io_t   <= bus_wdata[11:8];
+			bb_io_o   <= bus_wdata[7:4];
 		end
 
 	always @(posedge clk)
-		rxf_overflow_clr <= bus_cyc & bus_we & ~ack & ~bus_addr[0] & bus_wdata[29];
+		rxf_overflow_clr <= bus_cyc & bus_we & ~ack & (bus_addr == 3'b000) & bus_wdata[29];
 
 	assign rd_csr = {
-		rxf_empty, rxf_full, rxf_overflow, 1'b0,
-		txf_empty, txf_full, 2'b00,
+		rxf_empty, rxf_full, rxf_overflow, irq_ena,
+		txf_empty, txf_full, poll_ready, flash_qpi,
 		{ (8-N_CS){1'b0} }, bb_cs,
 		bb_clk, 3'b000,
 		bb_io_t, bb_io_o, bb_io_i
 	};
 
 	// TX FIFO write
-	assign txf_di   = bus_wdata[9:0];
+	assign txf_di   = pk_wbusy ? { 2'b00, pk_wdata[7:0] } : bus_wdata[9:0];
 
 	always @(posedge clk)
-		txf_wren <= bus_cyc & bus_we & ~ack & bus_addr[0] & ~txf_full;
+		txf_wren <= bus_cyc & bus_we & ~ack & bus_is_data & ~txf_full & ~pk_wbusy;
 
 	// RX FIFO read
-	assign rxf_rden = ack & bus_addr[0] & ~bus_we & ~bus_rdata[31];
+	assign rxf_rden = (ack & bus_is_data & ~bus_we & ~bus_rdata[31]) | pk_rden | dma_pop;
+
+	// Packed write : word is taken right away, bytes are pushed after.
+	// Also used for DMA writes, with only the bytes left.
+	always @(posedge clk)
+		if (rst)
+			pk_wcnt <= 3'd0;
+		else if (ack & bus_we & bus_is_pdata)
+			pk_wcnt <= 3'd4;
+		else if (dma_fetch)
+			pk_wcnt <= (dma_left[15:2] != 0) ? 3'd4 : { 1'b0, dma_left[1:0] };
+		else if (pk_wren)
+			pk_wcnt <= pk_wcnt - 1;
+
+	always @(posedge clk)
+		if (ack & bus_we & bus_is_pdata)
+			pk_wdata <= bus_wdata;
+		else if (dma_fetch)
+			pk_wdata <= dma_rdata;
+		else if (pk_wren)
+			pk_wdata <= { 8'h00, pk_wdata[31:8] };
+
+	assign pk_wbusy = (pk_wcnt != 3'd0);
+	assign pk_wren  = pk_wbusy & ~txf_full;
+
+	// Packed read : bytes are popped while the access is stalled
+	always @(posedge clk)
+		if (~bus_cyc | ack)
+			pk_rcnt <= 3'd0;
+		else if (pk_rden)
+			pk_rcnt <= pk_rcnt + 1;
+
+	always @(posedge clk)
+		if (pk_rden)
+			pk_rdata <= { rxf_do, pk_rdata[31:8] };
+
+	assign pk_rrdy = pk_rcnt[2];
+	assign pk_rden = bus_cyc & ~bus_we & bus_is_pdata & ~ack & ~pk_rrdy & ~rxf_empty;
 
 	// Read mux
 	assign rd_rst = ~bus_cyc | ack;
@@ -193,9 +413,15 @@ module qspi_master_wb #(
 		if (rd_rst)
 			bus_rdata <= 32'h00000000;
 		else
-			bus_rdata <= bus_addr[0] ?
-				{ rxf_empty, 23'b0, rxf_do } :
-				rd_csr;
+			case (bus_addr)
+				3'b000:  bus_rdata <= rd_csr;
+				3'b001:  bus_rdata <= { rxf_empty, 23'b0, rxf_do };
+				3'b010:  bus_rdata <= { poll_ena, poll_irq_ena, poll_ready, 5'b0, { (8-N_CS){1'b0} }, poll_cs, 8'h00, poll_sr };
+				3'b011:  bus_rdata <= pk_rdata;
+				3'b110:  bus_rdata <= { seq_req | seq_act | dma_act, 31'b0 };
+				3'b111:  bus_rdata <= { dma_ena, { (29-DMA_AW){1'b0} }, dma_ptr, 2'b00 };
+				default: bus_rdata <= 32'h00000000;
+			endcase
 
 
 	// FIFOs
@@ -203,11 +429,11 @@ module qspi_master_wb #(
 
 	// TX
 	fifo_sync_ram #(
-		.DEPTH(16),
+		.DEPTH(FIFO_DEPTH),
 		.WIDTH(10)
 	) tx_fifo_I (
 		.wr_data(txf_di),
-		.wr_ena(txf_wren),
+		.wr_ena(txf_wren | pk_wren),
 		.wr_full(txf_full),
 		.rd_data(txf_do),
 		.rd_ena(txf_rden),
@@ -218,7 +444,7 @@ module qspi_master_wb #(
 
 	// RX
 	fifo_sync_ram #(
-		.DEPTH(16),
+		.DEPTH(FIFO_DEPTH),
 		.WIDTH(8)
 	) rx_fifo_I (
 		.wr_data(rxf_di),
@@ -232,10 +458,10 @@ module qspi_master_wb #(
 	);
 
 	// RX Overflow tracking
-	assign rxf_wren_i = rxf_wren & ~rxf_full;
+	assign rxf_wren_i = rxf_wren & ~rxf_full & ~poll_act & ~seq_mem;
 
 	always @(posedge clk)
-		rxf_overflow <= (rxf_overflow & ~rxf_overflow_clr) | (rxf_wren & rxf_full);
+		rxf_overflow <= (rxf_overflow & ~rxf_overflow_clr) | (rxf_wren & rxf_full & ~poll_act & ~seq_mem);
 
 
 	// Shift registers
@@ -243,8 +469,8 @@ module qspi_master_wb #(
 
 	// Output
 	assign shift_out_ld_data = shift_out_ld_mode ?
-		{ txf_do[4], txf_do[5], txf_do[6], txf_do[7], txf_do[0], txf_do[1], txf_do[2], txf_do[3] } :
-		txf_do[7:0];
+		{ cmd_do[4], cmd_do[5], cmd_do[6], cmd_do[7], cmd_do[0], cmd_do[1], cmd_do[2], cmd_do[3] } :
+		cmd_do[7:0];
 
 	assign shift_out_shift_data = shift_out_shift_mode ?
 		{ shift_out[3:0], 4'h0 } :
@@ -267,7 +493,11 @@ module qspi_master_wb #(
 	// Control
 	// -------
 
-	// Commands
+	// Commands come from the TX FIFO, the status poller or the sequencer
+	assign cmd_do    = poll_act ? { flash_qpi, poll_step[0], poll_step[0] ? 8'h00 : 8'h05 } : (seq_act ? seq_do : txf_do);
+	assign cmd_empty = poll_act ? poll_step[1] : (seq_act ? seq_empty : (txf_empty | seq_req));
+	assign cmd_rden  = ~cmd_empty & (~cmd_valid | cmd_cnt[4]);
+
 	always @(posedge clk)
 		if (rst) begin
 			cmd_valid <= 1'b0;
@@ -275,27 +505,36 @@ module qspi_master_wb #(
 			cmd_cnt   <= 5'bxxxxx;
 		end else begin
 			if (~cmd_valid | cmd_cnt[4]) begin
-				cmd_valid <= ~txf_empty;
-				cmd_cur   <= txf_do[9:8];
-				cmd_cnt   <= txf_do[9] ? 5'd2 : 5'd14;
+				cmd_valid <= ~cmd_empty;
+				cmd_cur   <= cmd_do[9:8];
+				cmd_cnt   <= cmd_do[9] ? (fast ? 5'd0 : 5'd2) : (fast ? 5'd6 : 5'd14);
 			end else begin
 				cmd_cnt   <= cmd_cnt - 1;
 			end
 		end
 
-	assign txf_rden = ~txf_empty & (~cmd_valid | cmd_cnt[4]);
+	// Fast clock : one bit every cycle instead of every other one
+	assign fast   = seq_act & seq_fast;
+	assign bit_ce = fast | cmd_cnt[0];
+
+	assign txf_rden = cmd_rden & ~poll_act & (~seq_act | ((seq_step == SEQ_DATA) & ~seq_rd));
+
+	// IRQ when all queued commands are done, or the poller is
+	assign irq = (irq_ena & txf_empty & ~cmd_valid & ~seq_req & ~seq_act & ~dma_act) | (poll_irq_ena & poll_ready);
 
-	// CS is Bit-Banged
-	assign spi_cs_o = bb_cs;
+	// CS is Bit-Banged, or driven by the poller / sequencer
+	assign spi_cs_o = bb_cs & ~(poll_act ? poll_cs : (seq_act ? seq_cs : { N_CS{1'b0} }));
 
-	// Clock can be forced high
-	assign spi_sck_o = bb_clk | (cmd_valid & cmd_cnt[0]);
+	// Clock can be forced high. In fast mode, it's high during the
+	// second half of each cycle (PHY does the DDR).
+	assign sck_lvl   = bb_clk | (cmd_valid & cmd_cnt[0] & ~fast);
+	assign spi_sck_o = { sck_lvl | (cmd_valid & fast), sck_lvl };
 
 	// Shift Out control
-	assign shift_out_ld_mode = txf_do[9];
+	assign shift_out_ld_mode = cmd_do[9];
 	assign shift_out_shift_mode = cmd_cur[1];
-	assign shift_out_ld = txf_rden;
-	assign shift_out_ce = cmd_valid ? cmd_cnt[0] : ~txf_empty;
+	assign shift_out_ld = cmd_rden;
+	assign shift_out_ce = cmd_valid ? bit_ce : ~cmd_empty;
 
 	// IO control
 	always @(*)
@@ -317,18 +556,291 @@ module qspi_master_wb #(
 
 	assign bb_io_i = spi_io_i;
 
-	// Capture control
+	// Capture control. Input is sampled on the SCK rising edge normally
+	// (1 cycle later), on the next falling edge in fast mode (3 cycles
+	// later, relies on the round trip delay for hold).
+	always @(posedge clk)
+		if (rst) begin
+			cap_ce   <= 3'b000;
+			cap_last <= 3'b000;
+			rxf_wren <= 1'b0;
+		end else begin
+			cap_ce   <= { cap_ce[1:0],   cmd_valid & bit_ce };
+			cap_last <= { cap_last[1:0], cmd_valid & cmd_cnt[4] & cmd_cur[0] };	// Only for 'reads'
+			rxf_wren <= shift_in_last;
+		end
+
+	always @(posedge clk)
+	begin
+		cap_mode <= { cap_mode[1:0], cmd_cur[1] };
+		cap_fast <= { cap_fast[1:0], fast };
+	end
+
+	assign shift_in_ce   = (cap_ce[0]   & ~cap_fast[0]) | (cap_ce[2]   & cap_fast[2]);
+	assign shift_in_last = (cap_last[0] & ~cap_fast[0]) | (cap_last[2] & cap_fast[2]);
+	assign shift_in_mode = cap_fast[2] ? cap_mode[2] : cap_mode[0];
+
+
+	// Status poll
+	// -----------
+
+	// Config
+	assign poll_cfg_wr = ack & bus_we & (bus_addr == 3'b010);
+
+	always @(posedge clk)
+		if (rst) begin
+			poll_ena     <= 1'b0;
+			poll_irq_ena <= 1'b0;
+			poll_ready   <= 1'b1;
+			poll_cs      <= { N_CS{1'b0} };
+			poll_ival    <= 16'h0000;
+		end else if (poll_cfg_wr) begin
+			poll_ena     <= bus_wdata[31];
+			poll_irq_ena <= bus_wdata[30];
+			poll_ready   <= poll_ready & ~bus_wdata[31];
+			poll_cs      <= bus_wdata[16+N_CS-1:16];
+			poll_ival    <= bus_wdata[15:0];
+		end else if (poll_done & ~shift_in[0]) begin
+			poll_ena     <= 1'b0;
+			poll_ready   <= 1'b1;
+		end
+
+	// Interval timer, restarts after each poll
+	always @(posedge clk)
+		if (poll_cfg_wr | poll_done)
+			poll_cnt <= { 1'b0, poll_cfg_wr ? bus_wdata[15:0] : poll_ival };
+		else if (~poll_cnt[16])
+			poll_cnt <= poll_cnt - 1;
+
+	// Only start when nothing else is on the bus
+	assign poll_start = poll_ena & ~poll_act & poll_cnt[16] &
+		txf_empty & ~cmd_valid & (&bb_cs) & ~bus_cyc & ~ack &
+		~seq_req & ~seq_act & ~mem_req;
+
+	// Sequencing : WO 0x05, RW 0x00, capture (all 4 bit in QPI)
+	always @(posedge clk)
+		if (rst) begin
+			poll_act  <= 1'b0;
+			poll_step <= 2'b00;
+		end else begin
+			if (poll_start) begin
+				poll_act  <= 1'b1;
+				poll_step <= 2'b00;
+			end else if (poll_act) begin
+				poll_act  <= ~poll_done;
+				poll_step <= poll_step + cmd_rden;
+			end
+		end
+
+	assign poll_done = poll_act & rxf_wren;
+
+	always @(posedge clk)
+		if (poll_done)
+			poll_sr <= shift_in;
+
+
+	// Sequencer
+	// ---------
+
+	// Config
+	always @(posedge clk)
+		if (mem_start)
+			seq_addr <= mem_addr;
+		else if (ack & bus_we & (bus_addr == 3'b100))
+			seq_addr <= bus_wdata[23:0];
+		else if (seq_rden & (seq_step == SEQ_ADDR))
+			seq_addr <= { seq_addr[15:0], 8'h00 };
+
+	always @(posedge clk)
+		if (mem_start)
+			seq_len <= mem_len;
+		else if (ack & bus_we & (bus_addr == 3'b101))
+			seq_len <= bus_wdata[15:0];
+
+	assign seq_cmd_wr = ack & bus_we & (bus_addr == 3'b110) & ~seq_req & ~seq_act & ~dma_act;
+
+	always @(posedge clk)
+		if (seq_cmd_wr) begin
+			seq_rd     <= bus_wdata[30];
+			seq_q_cmd  <= bus_wdata[29];
+			seq_q_addr <= bus_wdata[28];
+			seq_q_data <= bus_wdata[27];
+			seq_fast   <= bus_wdata[21] & (FAST_SCK != 0);
+			seq_cs     <= 1 << bus_wdata[26:24];
+			seq_alen   <= bus_wdata[23:22];
+			seq_dlen   <= bus_wdata[19:16];
+			seq_op     <= bus_wdata[7:0];
+		end else if (mem_start) begin
+			seq_rd     <= 1'b1;
+			seq_q_cmd  <= flash_qpi;
+			seq_q_addr <= 1'b1;
+			seq_q_data <= 1'b1;
+			seq_fast   <= 1'b0;
+			seq_cs     <= 1;
+			seq_alen   <= 2'd3;
+			seq_dlen   <= 4'd3;
+			seq_op     <= flash_qpi ? 8'h0b : 8'heb;
+		end
+
+	// Start once the shifter is free, the TX FIFO is held meanwhile
+	// since it may already have write data. Done once the last byte
+	// is captured.
 	always @(posedge clk)
 		if (rst) begin
-			shift_in_ce   <= 1'b0;
-			shift_in_mode <= 1'b0;
-			shift_in_last <= 1'b0;
-			rxf_wren      <= 1'b0;
+			seq_req <= 1'b0;
+			seq_act <= 1'b0;
 		end else begin
-			shift_in_ce   <= cmd_valid & cmd_cnt[0];
-			shift_in_mode <= cmd_cur[1];
-			shift_in_last <= cmd_valid & cmd_cnt[4] & cmd_cur[0];	// Only for 'reads'
-			rxf_wren      <= shift_in_last;
+			seq_req <= (seq_req & ~seq_act) | seq_cmd_wr;
+			seq_act <= (seq_act & ~seq_end) | (seq_req & ~poll_act & ~cmd_valid) | mem_start;
+		end
+
+	assign seq_end = (seq_step == SEQ_DONE) & ~cmd_valid & ~(|cap_ce) & ~(|cap_last) & ~rxf_wren;
+
+	// Command words
+	assign seq_do =
+		(seq_step == SEQ_OP)    ? { seq_q_cmd,  1'b0, seq_op } :
+		(seq_step == SEQ_ADDR)  ? { seq_q_addr, 1'b0, seq_addr[23:16] } :
+		(seq_step == SEQ_DUMMY) ? { seq_q_addr, 1'b0, 8'h00 } :
+		seq_rd ? { seq_q_data, 1'b1, 8'h00 } :
+		{ seq_q_data, 1'b0, txf_do[7:0] };
+
+	// Write data waits for the TX FIFO, reads for room in the RX FIFO
+	assign seq_empty =
+		(seq_step == SEQ_DONE) |
+		((seq_step == SEQ_DATA) & ( seq_rd ? (seq_rxc[FL] & ~seq_mem) : txf_empty));
+
+	assign seq_rden = cmd_rden & seq_act & ~poll_act;
+
+	// Next step, skipping empty ones
+	always @(*)
+	begin
+		seq_step_nxt = seq_step;
+		seq_cnt_nxt  = seq_cnt - 1;
+
+		if ((seq_step == SEQ_OP) || (seq_cnt == 16'd1)) begin
+			if ((seq_step < SEQ_ADDR) && (seq_alen != 2'd0)) begin
+				seq_step_nxt = SEQ_ADDR;
+				seq_cnt_nxt  = { 14'd0, seq_alen };
+			end else if ((seq_step < SEQ_DUMMY) && (seq_dlen != 4'd0)) begin
+				seq_step_nxt = SEQ_DUMMY;
+				seq_cnt_nxt  = { 12'd0, seq_dlen };
+			end else if ((seq_step < SEQ_DATA) && (seq_len != 16'd0)) begin
+				seq_step_nxt = SEQ_DATA;
+				seq_cnt_nxt  = seq_len;
+			end else begin
+				seq_step_nxt = SEQ_DONE;
+			end
+		end
+	end
+
+	always @(posedge clk)
+		if (~seq_act) begin
+			seq_step <= SEQ_OP;
+			seq_cnt  <= 16'd0;
+		end else if (seq_rden) begin
+			seq_step <= seq_step_nxt;
+			seq_cnt  <= seq_cnt_nxt;
 		end
 
+	// Bytes read but not yet popped by the CPU, capped below the RX
+	// FIFO depth counting what's still in the shifter. RX FIFO has to
+	// be empty at the start.
+	always @(posedge clk)
+		if (~seq_act)
+			seq_rxc <= 2;
+		else
+			seq_rxc <= seq_rxc + (seq_rden & (seq_step == SEQ_DATA) & seq_rd) - rxf_rden;
+
+
+	// Memory read port
+	// ----------------
+
+	// Only when nobody else uses the bus. Data bypasses the RX FIFO.
+	assign mem_start = mem_req & ~seq_req & ~seq_act & ~poll_act &
+		~cmd_valid & txf_empty & (&bb_cs);
+
+	always @(posedge clk)
+		if (rst)
+			seq_mem <= 1'b0;
+		else
+			seq_mem <= (seq_mem & ~seq_end) | mem_start;
+
+	assign mem_data = shift_in;
+	assign mem_stb  = rxf_wren & seq_mem;
+	assign mem_done = seq_end & seq_mem;
+
+
+
+	// DMA
+	// ---
+
+	// Config, armed for the next sequencer command
+	always @(posedge clk)
+		if (rst)
+			dma_ena <= 1'b0;
+		else if (ack & bus_we & (bus_addr == 3'b111))
+			dma_ena <= bus_wdata[31];
+		else if (seq_cmd_wr)
+			dma_ena <= 1'b0;
+
+	always @(posedge clk)
+		if (rst)
+			dma_act <= 1'b0;
+		else
+			dma_act <= (dma_act & (dma_left != 0)) | (seq_cmd_wr & dma_ena & (seq_len != 0));
+
+	always @(posedge clk)
+		if (seq_cmd_wr)
+			dma_rd <= bus_wdata[30];
+
+	always @(posedge clk)
+		if (seq_cmd_wr)
+			dma_left <= seq_len;
+		else if (dma_fetch)
+			dma_left <= (dma_left[15:2] != 0) ? (dma_left - 4) : 16'd0;
+		else if (dma_pop)
+			dma_left <= dma_left - 1;
+
+	always @(posedge clk)
+		if (ack & bus_we & (bus_addr == 3'b111))
+			dma_ptr <= bus_wdata[DMA_AW+1:2];
+		else if (dma_fetch | dma_we)
+			dma_ptr <= dma_ptr + 1;
+
+	assign dma_addr = dma_ptr;
+
+	// Write : fetch a word whenever the packer is empty
+	assign dma_fetch_start = dma_act & ~dma_rd & (dma_left != 0) & ~pk_wbusy & ~dma_fetch;
+
+	always @(posedge clk)
+		if (rst)
+			dma_fetch <= 1'b0;
+		else
+			dma_fetch <= dma_fetch_start;
+
+	// Read : gather bytes, store each word once full or on the last byte
+	assign dma_pop = dma_act & dma_rd & (dma_left != 0) & ~rxf_empty & ~dma_we;
+
+	always @(posedge clk)
+		if (~dma_act)
+			dma_idx <= 2'd0;
+		else if (dma_pop)
+			dma_idx <= dma_idx + 1;
+
+	always @(posedge clk)
+		if (dma_pop)
+			dma_wdata[{dma_idx, 3'b000} +: 8] <= rxf_do;
+
+	always @(posedge clk)
+		if (~dma_act | dma_we)
+			dma_wmsk <= 4'h0;
+		else if (dma_pop)
+			dma_wmsk[dma_idx] <= 1'b1;
+
+	always @(posedge clk)
+		if (rst)
+			dma_we <= 1'b0;
+		else
+			dma_we <= dma_pop & ((dma_idx == 2'd3) | (dma_left == 16'd1));
+
 endmodule // qspi_master_wb
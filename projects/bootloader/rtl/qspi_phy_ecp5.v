@@ -35,7 +35,8 @@
 
 module qspi_phy_ecp5 #(
 	parameter integer N_CS = 1,
-	parameter integer IS_SYS_CFG = 0	// If set, then CS/CLK is sys_config port
+	parameter integer IS_SYS_CFG = 0,	// If set, then CS/CLK is sys_config port
+	parameter integer FAST_SCK = 0		// If set, SCK can toggle every 'clk'
 )(
 	// SPI Pads
 	inout  wire [3:0] spi_io,
@@ -47,11 +48,12 @@ module qspi_phy_ecp5 #(
 	input  wire [3:0] spi_io_o,
 	input  wire [3:0] spi_io_t,
 
-	input  wire spi_sck_o,
+	input  wire [1:0] spi_sck_o,	// First / second half of the cycle
 	input  wire [N_CS-1:0] spi_cs_o,
 
 	// Clock
 	input  wire clk,
+	input  wire clk_2x,		// Only for IS_SYS_CFG & FAST_SCK, 2x 'clk', same PLL
 	input  wire rst
 );
 	wire [3:0] spi_io_ir;
@@ -112,16 +114,49 @@ module qspi_phy_ecp5 #(
 		.O()
 	);
 
-	// Clock
+	// Clock. Without FAST_SCK, both halves are the same
 	generate
-		if (IS_SYS_CFG) begin
+		if (IS_SYS_CFG && !FAST_SCK) begin
 			reg spi_sck_or;
 
 			always @(posedge clk)
 				if (rst)
 					spi_sck_or <= 1'b0;
 				else
-					spi_sck_or <= spi_sck_o;
+					spi_sck_or <= spi_sck_o[0];
+
+			USRMCLK usrmclk_inst (
+				.USRMCLKI(spi_sck_or),
+				.USRMCLKTS(rst)
+			) /* synthesis syn_noprune=1 */;
+		end else if (IS_SYS_CFG) begin
+			// No DDR register on USRMCLK, do it from 'clk_2x'. 'clk_ph'
+			// toggles every 'clk', seeing it unchanged means the first
+			// half of the 'clk' cycle starts.
+			reg clk_ph;
+			reg clk_ph_2x;
+			reg spi_sck_hi;
+			reg spi_sck_or;
+
+			always @(posedge clk)
+				if (rst)
+					clk_ph <= 1'b0;
+				else
+					clk_ph <= ~clk_ph;
+
+			always @(posedge clk_2x)
+				clk_ph_2x <= clk_ph;
+
+			always @(posedge clk_2x)
+				if (rst) begin
+					spi_sck_or <= 1'b0;
+					spi_sck_hi <= 1'b0;
+				end else if (clk_ph == clk_ph_2x) begin
+					spi_sck_or <= spi_sck_o[0];
+					spi_sck_hi <= spi_sck_o[1];
+				end else begin
+					spi_sck_or <= spi_sck_hi;
+				end
 
 			USRMCLK usrmclk_inst (
 				.USRMCLKI(spi_sck_or),
@@ -130,13 +165,23 @@ module qspi_phy_ecp5 #(
 		end else begin
 			wire spi_sck_or;
 
-			OFS1P3DX phy_clk_reg_I (
-				.CD(rst),
-				.D(spi_sck_o),
-				.SP(1'b1),
-				.SCLK(clk),
-				.Q(spi_sck_or)
-			);
+			if (FAST_SCK) begin
+				ODDRX1F phy_clk_reg_I (
+					.D0(spi_sck_o[0]),
+					.D1(spi_sck_o[1]),
+					.SCLK(clk),
+					.RST(rst),
+					.Q(spi_sck_or)
+				);
+			end else begin
+				OFS1P3DX phy_clk_reg_I (
+					.CD(rst),
+					.D(spi_sck_o[0]),
+					.SP(1'b1),
+					.SCLK(clk),
+					.Q(spi_sck_or)
+				);
+			end
 
 			TRELLIS_IO #(
 				.DIR("OUTPUT")
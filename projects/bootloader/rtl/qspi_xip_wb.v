@@ -0,0 +1,218 @@
+/*
+ * qspi_xip_wb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019  Sylvain Munaut <tnt@246tNt.com>
+ * All rights reserved.
+ *
+ * BSD 3-clause, see LICENSE.bsd
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+`default_nettype none
+
+module qspi_xip_wb #(
+	parameter integer AW = 22,		// Word address, 16 Mbytes
+	parameter integer LINES_LOG2 = 6	// 32 bytes lines
+)(
+	// Fill requests to qspi_master_wb
+	output wire [23:0] fill_addr,
+	output wire [15:0] fill_len,
+	output reg  fill_req,
+	input  wire [ 7:0] fill_data,
+	input  wire fill_stb,
+	input  wire fill_done,
+
+	// Wishbone interface
+	input  wire [AW-1:0] bus_addr,
+	output reg  [31:0] bus_rdata,
+	input  wire bus_cyc,
+	output reg  bus_ack,
+	input  wire bus_we,
+
+	// Clock
+	input  wire clk,
+	input  wire rst
+);
+
+	//
+	// Read-only window on the flash. Direct-mapped cache of 32 bytes
+	// lines, a miss fetches the line and the next one with a single
+	// quad I/O read. The request is served as soon as the first
+	// line is in, the second one completes in the background.
+	//
+	// Any write invalidates the whole cache. This must be done after
+	// the flash content or the selected chip changed, and nothing may
+	// be fetched through here while the flash is busy. A fill still
+	// in flight at that point completes but its lines are not kept.
+	//
+
+	localparam integer TW = AW - 3 - LINES_LOG2;
+
+	// Signals
+	// -------
+
+	// Address split
+	wire [TW-1:0] req_tag;
+	wire [LINES_LOG2-1:0] req_line;
+	wire [2:0] req_word;
+
+	// Tags
+	reg  [TW-1:0] tag_mem [0:(1<<LINES_LOG2)-1];
+	reg  [(1<<LINES_LOG2)-1:0] tag_valid;
+	wire hit;
+
+	// Data
+	reg  [31:0] data_mem [0:(8<<LINES_LOG2)-1];
+	reg  [31:0] data_rd;
+	reg  [LINES_LOG2+2:0] data_wr_addr;
+	reg  [31:0] data_wr;
+	reg  data_we;
+
+	// Fill
+	reg  fill_busy;
+	wire fill_start;
+	reg  [TW-1:0] fill_tag;
+	reg  [LINES_LOG2-1:0] fill_line;
+	reg  [5:0] fill_cnt;
+	reg  [31:0] fill_word;
+	wire fill_line_end;
+	wire inval;
+	reg  inval_pend;
+
+	// Bus
+	reg  rd_pend;
+
+
+	// Lookup
+	// ------
+
+	assign { req_tag, req_line, req_word } = bus_addr;
+
+	assign hit = tag_valid[req_line] & (tag_mem[req_line] == req_tag);
+
+	// Data read, a cycle after the request, ack'ed the cycle after
+	always @(posedge clk)
+		data_rd <= data_mem[{ req_line, req_word }];
+
+	always @(posedge clk)
+		if (rst)
+			rd_pend <= 1'b0;
+		else
+			rd_pend <= bus_cyc & ~bus_we & ~bus_ack & ~rd_pend & hit;
+
+	always @(posedge clk)
+		if (rst)
+			bus_ack <= 1'b0;
+		else
+			bus_ack <= (bus_cyc & bus_we & ~bus_ack) | rd_pend;
+
+	always @(posedge clk)
+		bus_rdata <= rd_pend ? data_rd : 32'h00000000;
+
+
+	// Fill
+	// ----
+
+	// Miss : fetch this line and the next, unless already busy
+	always @(posedge clk)
+		if (rst)
+			fill_req <= 1'b0;
+		else
+			fill_req <= (fill_req & ~fill_done) |
+				(bus_cyc & ~bus_we & ~bus_ack & ~rd_pend & ~hit & ~fill_busy);
+
+	always @(posedge clk)
+		if (rst)
+			fill_busy <= 1'b0;
+		else
+			fill_busy <= (fill_busy & ~fill_done) | fill_req;
+
+	always @(posedge clk)
+		if (~fill_busy & ~fill_req) begin
+			fill_tag  <= req_tag;
+			fill_line <= req_line;
+		end
+
+	assign fill_addr = { fill_tag, fill_line, 5'b00000 };
+	assign fill_len  = 16'd64;
+
+	// Bytes come LSB first, one word every 4
+	always @(posedge clk)
+		if (~fill_busy)
+			fill_cnt <= 6'd0;
+		else if (fill_stb)
+			fill_cnt <= fill_cnt + 1;
+
+	always @(posedge clk)
+		if (fill_stb)
+			fill_word <= { fill_data, fill_word[31:8] };
+
+	always @(posedge clk)
+	begin
+		data_we      <= fill_stb & (fill_cnt[1:0] == 2'b11);
+		data_wr      <= { fill_data, fill_word[31:8] };
+		data_wr_addr <= { fill_line + fill_cnt[5], fill_cnt[4:2] };
+	end
+
+	always @(posedge clk)
+		if (data_we)
+			data_mem[data_wr_addr] <= data_wr;
+
+	// Line valid once its last word is written
+	assign fill_line_end = data_we & (data_wr_addr[2:0] == 3'b111);
+
+	// Second line may wrap to the next tag
+	always @(posedge clk)
+		if (fill_line_end)
+			tag_mem[data_wr_addr[LINES_LOG2+2:3]] <= fill_tag +
+				((data_wr_addr[LINES_LOG2+2:3] != fill_line) & (&fill_line));
+
+	assign fill_start = fill_req & ~fill_busy;
+
+	// Invalidate
+	assign inval = bus_cyc & bus_we & ~bus_ack;
+
+	// Fill started before it : drop its lines, up to the next one. Not
+	// cleared on fill_done since the last word is written after it
+	always @(posedge clk)
+		if (rst)
+			inval_pend <= 1'b0;
+		else
+			inval_pend <= (inval_pend & ~fill_start) | (inval & (fill_req | fill_busy));
+
+	always @(posedge clk)
+		if (rst | inval)
+			tag_valid <= 0;
+		else begin
+			if (fill_start) begin
+				tag_valid[fill_line] <= 1'b0;
+				tag_valid[fill_line + 1'b1] <= 1'b0;
+			end
+			if (fill_line_end & ~inval_pend)
+				tag_valid[data_wr_addr[LINES_LOG2+2:3]] <= 1'b1;
+		end
+
+endmodule // qspi_xip_wb
@@ -42,21 +42,49 @@ module soc_bram #(
 	input  wire [31:0] wdata,
 	input  wire [ 3:0] wmsk,
 	input  wire we,
+
+	// Second port, for DMA. Reads on their own port, writes take over
+	// the first one for that cycle (see 'stall'). A single write port
+	// keeps it mapping to EBRs as 1 R/W + 1 R.
+	input  wire [AW-1:0] b_addr,
+	output reg  [31:0] b_rdata,
+	input  wire [31:0] b_wdata,
+	input  wire [ 3:0] b_wmsk,
+	input  wire b_we,
+
+	output wire stall,		// First port access not done this cycle
+
 	input  wire clk
 );
 
 	reg [31:0] mem [0:(1<<AW)-1];
 
+	wire [AW-1:0] w_addr;
+	wire [31:0] w_data;
+	wire [ 3:0] w_msk;
+	wire w_en;
+
 	initial
 		if (INIT_FILE != "")
 			$readmemh(INIT_FILE, mem);
 
+	// DMA writes have priority
+	assign w_addr = b_we ? b_addr  : addr;
+	assign w_data = b_we ? b_wdata : wdata;
+	assign w_msk  = b_we ? b_wmsk  : wmsk;
+	assign w_en   = b_we | we;
+
+	assign stall  = b_we;
+
 	always @(posedge clk) begin
-		rdata <= mem[addr];
-		if (we & wmsk[0]) mem[addr][ 7: 0] <= wdata[ 7: 0];
-		if (we & wmsk[1]) mem[addr][15: 8] <= wdata[15: 8];
-		if (we & wmsk[2]) mem[addr][23:16] <= wdata[23:16];
-		if (we & wmsk[3]) mem[addr][31:24] <= wdata[31:24];
+		rdata <= mem[w_addr];
+		if (w_en & w_msk[0]) mem[w_addr][ 7: 0] <= w_data[ 7: 0];
+		if (w_en & w_msk[1]) mem[w_addr][15: 8] <= w_data[15: 8];
+		if (w_en & w_msk[2]) mem[w_addr][23:16] <= w_data[23:16];
+		if (w_en & w_msk[3]) mem[w_addr][31:24] <= w_data[31:24];
 	end
 
+	always @(posedge clk)
+		b_rdata <= mem[b_addr];
+
 endmodule // soc_bram
@@ -55,6 +55,7 @@ module soc_bridge #(
 	output wire [31:0] bram_wdata,
 	output wire [ 3:0] bram_wmsk,
 	output wire        bram_we,
+	input  wire        bram_stall,	// Access not done, retry next cycle
 
 	/* Wishbone buses */
 	output wire [WB_AW-1:0] wb_addr,
@@ -98,7 +99,7 @@ module soc_bridge #(
 	assign ram_sel = pb_valid & ~pb_addr[31];
 
 	always @(posedge clk)
-		ram_rdy <= ram_sel && ~ram_rdy;
+		ram_rdy <= ram_sel && ~ram_rdy && ~bram_stall;
 
 
 	// Wishbone
@@ -102,10 +102,16 @@ module top (
 	localparam WB_AW = 16;
 	localparam WB_AI =  2;
 
+	localparam SPI_FAST_SCK = 0;	/* 48 MHz SCK, see SPI_FAST_CLK in fw/config.h */
+	localparam CPU_IRQ = 0;		/* IRQ support, see USE_IRQ in fw/config.h */
+
 
 	// Signals
 	// -------
 
+	// CPU IRQs
+	wire [31:0] cpu_irq;
+
 	// Memory bus
 	wire        mem_valid;
 	wire        mem_instr;
@@ -121,6 +127,13 @@ module top (
 	wire [31:0] bram_wdata;
 	wire [ 3:0] bram_wmsk;
 	wire        bram_we;
+	wire        bram_stall;
+
+	wire [RAM_AW-1:0] dma_addr;
+	wire [31:0] dma_rdata;
+	wire [31:0] dma_wdata;
+	wire [ 3:0] dma_wmsk;
+	wire        dma_we;
 
 	// Wishbone
 	wire [WB_AW-1:0] wb_addr;
@@ -180,8 +193,11 @@ module top (
 		.ENABLE_COUNTERS64(0),
 		.ENABLE_MUL(0),
 		.ENABLE_DIV(0),
-		.ENABLE_IRQ(0),
-		.ENABLE_IRQ_QREGS(0),
+		.ENABLE_IRQ(CPU_IRQ),
+		.ENABLE_IRQ_QREGS(CPU_IRQ),
+		.ENABLE_IRQ_TIMER(CPU_IRQ),
+		.LATCHED_IRQ(32'hffff_ffb7),	/* USB events & SPI are level */
+		.PROGADDR_IRQ(32'h 0000_0010),
 		.CATCH_MISALIGN(0),
 		.CATCH_ILLINSN(0)
 	) cpu_I (
@@ -193,9 +209,24 @@ module top (
 		.mem_addr  (mem_addr),
 		.mem_wdata (mem_wdata),
 		.mem_wstrb (mem_wstrb),
-		.mem_rdata (mem_rdata)
+		.mem_rdata (mem_rdata),
+		.irq       (cpu_irq),
+		.eoi       ()
 	);
 
+	// IRQs
+	//  [0] Timer, [1] EBREAK/ECALL, [2] Bus error (internal)
+	//  [3] USB events pending
+	//  [4] USB SOF
+	//  [5] USB bus reset end
+	//  [6] SPI done
+	wire usb_irq;
+	wire usb_sof;
+	wire usb_bus_reset;
+	wire spi_irq;
+
+	assign cpu_irq = { 25'd0, spi_irq, usb_bus_reset, usb_sof, usb_irq, 3'b000 };
+
 	// Bridge
 	soc_bridge #(
 		.RAM_AW(RAM_AW),
@@ -215,6 +246,7 @@ module top (
 		.bram_wdata(bram_wdata),
 		.bram_wmsk(bram_wmsk),
 		.bram_we(bram_we),
+		.bram_stall(bram_stall),
 		.wb_addr(wb_addr),
 		.wb_wdata(wb_wdata),
 		.wb_wmsk(wb_wmsk),
@@ -239,6 +271,12 @@ module top (
 		.wdata(bram_wdata),
 		.wmsk(bram_wmsk),
 		.we(bram_we),
+		.b_addr(dma_addr),
+		.b_rdata(dma_rdata),
+		.b_wdata(dma_wdata),
+		.b_wmsk(dma_wmsk),
+		.b_we(dma_we),
+		.stall(bram_stall),
 		.clk(clk_48m)
 	);
 
@@ -307,6 +345,9 @@ module top (
 		.bus_cyc(wb_cyc[2]),
 		.bus_we(wb_we),
 		.bus_ack(wb_ack[2]),
+		.irq(usb_irq),
+		.sof(usb_sof),
+		.bus_reset(usb_bus_reset),
 		.clk(clk_48m),
 		.rst(rst)
 	);
@@ -337,23 +378,38 @@ module top (
 	reg  [3:0] spi_io_i;
 	wire [3:0] spi_io_o;
 	wire [3:0] spi_io_t;
-	wire       spi_sck_o;
+	wire [1:0] spi_sck_o;
 	wire [2:0] spi_cs_o;
 
 	qspi_master_wb #(
-		.N_CS(3)
+		.N_CS(3),
+		.FIFO_DEPTH(256),
+		.DMA_AW(RAM_AW),
+		.FAST_SCK(SPI_FAST_SCK)
 	) spi_master_I (
 		.spi_io_i(spi_io_i),
 		.spi_io_o(spi_io_o),
 		.spi_io_t(spi_io_t),
 		.spi_sck_o(spi_sck_o),
 		.spi_cs_o(spi_cs_o),
-		.bus_addr(wb_addr[1:0]),
+		.bus_addr(wb_addr[2:0]),
 		.bus_wdata(wb_wdata),
 		.bus_rdata(wb_rdata[4]),
 		.bus_cyc(wb_cyc[4]),
 		.bus_we(wb_we),
 		.bus_ack(wb_ack[4]),
+		.mem_addr(24'h000000),	// No XIP window (qspi_xip_wb) for now
+		.mem_len(16'h0000),
+		.mem_req(1'b0),
+		.mem_data(),
+		.mem_stb(),
+		.mem_done(),
+		.dma_addr(dma_addr),
+		.dma_rdata(dma_rdata),
+		.dma_wdata(dma_wdata),
+		.dma_wmsk(dma_wmsk),
+		.dma_we(dma_we),
+		.irq(spi_irq),
 		.clk(clk_48m),
 		.rst(rst)
 	);
@@ -361,7 +417,8 @@ module top (
 		// PHY to Flash
 	qspi_phy_ecp5 #(
 		.N_CS(1),
-		.IS_SYS_CFG(1)
+		.IS_SYS_CFG(1),
+		.FAST_SCK(SPI_FAST_SCK)
 	) spi_phy_flash_I (
 		.spi_io({flash_hold, flash_wp, flash_miso, flash_mosi}),
 		.spi_cs(flash_cs),
@@ -369,16 +426,18 @@ module top (
 		.spi_io_i(spi_io_i_flash),
 		.spi_io_o(spi_io_o),
 		.spi_io_t(spi_cs_o[0] ? 4'hf : spi_io_t),
-		.spi_sck_o(spi_cs_o[0] ? 1'b0 : spi_sck_o),
+		.spi_sck_o(spi_cs_o[0] ? 2'b00 : spi_sck_o),
 		.spi_cs_o(spi_cs_o[0]),
 		.clk(clk_48m),
+		.clk_2x(clk_96m),
 		.rst(rst)
 	);
 
 		// PHY to PSRAM A
 	qspi_phy_ecp5 #(
 		.N_CS(1),
-		.IS_SYS_CFG(0)
+		.IS_SYS_CFG(0),
+		.FAST_SCK(SPI_FAST_SCK)
 	) spi_phy_psrama_I (
 		.spi_io(psrama_sio),
 		.spi_cs(psrama_nce),
@@ -386,16 +445,18 @@ module top (
 		.spi_io_i(spi_io_i_psrama),
 		.spi_io_o(spi_io_o),
 		.spi_io_t(spi_cs_o[1] ? 4'hf : spi_io_t),
-		.spi_sck_o(spi_cs_o[1] ? 1'b0 : spi_sck_o),
+		.spi_sck_o(spi_cs_o[1] ? 2'b00 : spi_sck_o),
 		.spi_cs_o(spi_cs_o[1]),
 		.clk(clk_48m),
+		.clk_2x(1'b0),
 		.rst(rst)
 	);
 
 		// PHY to PSRAM B
 	qspi_phy_ecp5 #(
 		.N_CS(1),
-		.IS_SYS_CFG(0)
+		.IS_SYS_CFG(0),
+		.FAST_SCK(SPI_FAST_SCK)
 	) spi_phy_psramb_I (
 		.spi_io(psramb_sio),
 		.spi_cs(psramb_nce),
@@ -403,9 +464,10 @@ module top (
 		.spi_io_i(spi_io_i_psramb),
 		.spi_io_o(spi_io_o),
 		.spi_io_t(spi_cs_o[2] ? 4'hf : spi_io_t),
-		.spi_sck_o(spi_cs_o[2] ? 1'b0 : spi_sck_o),
+		.spi_sck_o(spi_cs_o[2] ? 2'b00 : spi_sck_o),
 		.spi_cs_o(spi_cs_o[2]),
 		.clk(clk_48m),
+		.clk_2x(1'b0),
 		.rst(rst)
 	);
 
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+
+#
+# Packs several images in a container for the bootloader composite
+# DFU alt setting. See fw/usb_dfu.c for the format
+#
+# Usage: dfu_composite.py out.bin zone:offset:file[:ref] [...]
+#
+#  zone   is the alt setting of the target zone (0 - 4)
+#  offset is relative to the zone start and must be 4k aligned
+#  ref    optional, what's currently in flash at that offset. Only the
+#         4k sectors that differ from it are sent, the device leaves
+#         the others untouched
+#
+# The result can be compressed with dfu_lz.py
+#
+
+import struct
+import sys
+
+
+BLK_LEN = 4096
+MAGIC   = b'DFUC'
+ZONES   = [
+	0x00180000,	# ECP5 bitstream
+	0x00080000,	# RISC-V firmware
+	0x00180000,	# Cart ECP5 bitstream
+	0x00080000,	# Cart IPL region
+	0x00e00000,	# Cart filesystem region
+]
+
+
+def pad(data):
+	return data + b'\xff' * (-len(data) % BLK_LEN)
+
+
+def segment(zone, offset, data):
+	if zone >= len(ZONES):
+		raise ValueError('Invalid zone %d' % zone)
+	if offset % BLK_LEN:
+		raise ValueError('Offset 0x%x is not 4k aligned' % offset)
+	if (offset + len(data)) > ZONES[zone]:
+		raise ValueError('%d bytes at 0x%x overflow zone %d' % (len(data), offset, zone))
+
+	hdr = MAGIC + struct.pack('<BxxxII', zone, offset, len(data))
+
+	return pad(hdr) + pad(data)
+
+
+def sparse(data, ref):
+	# Runs of sectors that differ from 'ref', as (offset, length). A
+	# single identical sector costs as much as a new segment header,
+	# so don't split runs for it
+	blocks = [ i for i in range(0, len(data), BLK_LEN)
+		if pad(data[i:i+BLK_LEN]) != pad(ref[i:i+BLK_LEN]) ]
+
+	runs = []
+	for b in blocks:
+		if runs and (b - (runs[-1][0] + runs[-1][1])) <= BLK_LEN:
+			runs[-1][1] = b - runs[-1][0] + BLK_LEN
+		else:
+			runs.append([b, BLK_LEN])
+
+	return [ (o, min(l, len(data) - o)) for o, l in runs ]
+
+
+def main(argv0, out_name, *segs):
+	out = bytearray()
+
+	for s in segs:
+		zone, offset, in_name, *ref_name = s.split(':', 3)
+		zone, offset = int(zone, 0), int(offset, 0)
+
+		with open(in_name, 'rb') as in_fh:
+			data = in_fh.read()
+
+		if ref_name:
+			with open(ref_name[0], 'rb') as ref_fh:
+				runs = sparse(data, ref_fh.read())
+		else:
+			runs = [ (0, len(data)) ]
+
+		for o, l in runs:
+			out.extend(segment(zone, offset + o, data[o:o+l]))
+
+			sys.stderr.write('zone %d @ 0x%06x : %d bytes\n' % (zone, offset + o, l))
+
+	with open(out_name, 'wb') as out_fh:
+		out_fh.write(out)
+
+if __name__ == '__main__':
+	main(*sys.argv)
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+#
+# Compresses an image for the bootloader compressed DFU mode
+# See fw/lz_dec.h for the format
+#
+
+import struct
+import sys
+
+
+BLK_LEN   = 4096
+MIN_MATCH = 3
+MAX_MATCH = 130
+MAX_LIT   = 128
+MAX_CHAIN = 32
+
+
+def compress_block(blk):
+	out = bytearray()
+	lit = bytearray()
+	chains = {}
+
+	def flush():
+		if lit:
+			out.append(len(lit) - 1)
+			out.extend(lit)
+			lit.clear()
+
+	def insert(i):
+		if i + MIN_MATCH <= len(blk):
+			chains.setdefault(blk[i:i+MIN_MATCH], []).append(i)
+
+	i = 0
+	while i < len(blk):
+		# Find longest match, most recent first
+		best_len, best_dist = 0, 0
+		max_len = min(MAX_MATCH, len(blk) - i)
+
+		for p in reversed(chains.get(blk[i:i+MIN_MATCH], [])[-MAX_CHAIN:]):
+			l = 0
+			while (l < max_len) and (blk[p+l] == blk[i+l]):
+				l += 1
+			if l > best_len:
+				best_len, best_dist = l, i - p
+				if l == max_len:
+					break
+
+		# Emit
+		if best_len >= MIN_MATCH:
+			flush()
+			out.append(0x80 | (best_len - MIN_MATCH))
+			out.extend(struct.pack('<H', best_dist))
+			for j in range(i, i + best_len):
+				insert(j)
+			i += best_len
+		else:
+			lit.append(blk[i])
+			if len(lit) == MAX_LIT:
+				flush()
+			insert(i)
+			i += 1
+
+	flush()
+
+	return out
+
+
+def compress(data):
+	out = bytearray(b'DFUZ')
+	out.extend(struct.pack('<I', len(data)))
+
+	for ofs in range(0, len(data), BLK_LEN):
+		c = compress_block(data[ofs:ofs+BLK_LEN])
+		out.extend(struct.pack('<H', len(c)))
+		out.extend(c)
+
+	return out
+
+
+def main(argv0, in_name, out_name):
+	with open(in_name, 'rb') as in_fh:
+		data = in_fh.read()
+
+	out = compress(data)
+
+	with open(out_name, 'wb') as out_fh:
+		out_fh.write(out)
+
+	sys.stderr.write('%d -> %d bytes\n' % (len(data), len(out)))
+
+if __name__ == '__main__':
+	main(*sys.argv)